@@ -0,0 +1,1831 @@
+﻿// Copyright (C) 2012 Google Inc.
+// Copyright (C) 2020 D Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The definitions of BasicJsonSanitizer's members. The library is built with
+// the sanitizers named in JSONSanitiser.hpp; include this to build one with a
+// policy of your own.
+
+#pragma once
+
+#include "JSONSanitiser.hpp"
+
+#include <array>
+#include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+
+namespace com::google::json::detail {
+
+inline constexpr std::array<char, 16> HEX_DIGITS = {'0', '1', '2', '3', '4', '5', '6', '7',
+                                                    '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
+
+// Character classes. Every structural decision the sanitizer makes is on an
+// ASCII byte, so these are looked up per byte and UTF-8 is only decoded for
+// bytes >= 0x80.
+enum : uint8_t
+{
+    DIGIT     = 1u << 0, // [0-9]
+    OCT_DIGIT = 1u << 1, // [0-7]
+    HEX_DIGIT = 1u << 2, // [0-9a-fA-F]
+    NUMERIC   = 1u << 3  // [0-9.+\-eE], the characters that may make up a number
+};
+
+constexpr std::array<uint8_t, 256> makeCharClasses() noexcept
+{
+    std::array<uint8_t, 256> table = {};
+    for (unsigned int c = '0'; c <= '9'; ++c) {
+        table[c] |= DIGIT | HEX_DIGIT | NUMERIC;
+    }
+    for (unsigned int c = '0'; c <= '7'; ++c) {
+        table[c] |= OCT_DIGIT;
+    }
+    for (unsigned int c = 'a'; c <= 'f'; ++c) {
+        table[c] |= HEX_DIGIT;
+        table[c - 'a' + 'A'] |= HEX_DIGIT;
+    }
+    for (unsigned char c : {'.', '+', '-', 'e', 'E'}) {
+        table[c] |= NUMERIC;
+    }
+    return table;
+}
+
+inline constexpr std::array<uint8_t, 256> CHAR_CLASSES = makeCharClasses();
+
+inline bool isClass(char c, uint8_t cls) noexcept
+{
+    return (CHAR_CLASSES[static_cast<unsigned char>(c)] & cls) != 0;
+}
+
+inline bool isAscii(char c) noexcept
+{
+    return static_cast<unsigned char>(c) < 0x80;
+}
+
+// How far past the end of a token sanitizing it can look: a UTF-8 sequence of
+// up to six bytes starting just after it.
+inline constexpr size_t TOKEN_LOOKAHEAD = 6;
+
+// How much rewritten output is gathered before it is passed on to a sink.
+inline constexpr size_t SINK_CHUNK_SIZE = 64 * 1024;
+
+// Adds the repairs made to a document of inputLength bytes to callerStats, if
+// there is one, and to the process totals if they are being kept.
+inline void recordStats(SanitizeStats &documentStats, size_t inputLength,
+                        SanitizeStats *callerStats)
+{
+    documentStats.documents  = 1;
+    documentStats.inputBytes = inputLength;
+    if (callerStats != nullptr) {
+        *callerStats += documentStats;
+    }
+    if (RepairStatistics::enabled()) {
+        RepairStatistics::record(documentStats);
+    }
+}
+
+// The length of the well-formed UTF-8 character at s[i], or 0 if it is
+// malformed or truncated, or is one that sanitizeString() rewrites: U+2028,
+// U+2029, a surrogate, U+FFFE or U+FFFF.
+inline size_t plainUtf8Length(std::string_view s, size_t i) noexcept
+{
+    auto const byte = [&s, i](size_t k) -> unsigned int {
+        return (i + k < s.length()) ? static_cast<unsigned char>(s[i + k]) : 0u;
+    };
+    auto const isContinuation = [](unsigned int b) { return (b & 0xc0u) == 0x80u; };
+
+    auto const b0 = byte(0);
+    auto const b1 = byte(1);
+    if ((0xc2 <= b0) && (b0 <= 0xdf)) {
+        return isContinuation(b1) ? 2 : 0;
+    }
+    if ((0xe0 <= b0) && (b0 <= 0xef)) {
+        auto const b2 = byte(2);
+        if (!isContinuation(b1) || !isContinuation(b2) || ((b0 == 0xe0) && (b1 < 0xa0)) ||
+            ((b0 == 0xed) && (b1 >= 0xa0)) ||
+            ((b0 == 0xe2) && (b1 == 0x80) && ((b2 == 0xa8) || (b2 == 0xa9))) ||
+            ((b0 == 0xef) && (b1 == 0xbf) && (b2 >= 0xbe))) {
+            return 0;
+        }
+        return 3;
+    }
+    if ((0xf0 <= b0) && (b0 <= 0xf4)) {
+        if (!isContinuation(b1) || !isContinuation(byte(2)) || !isContinuation(byte(3)) ||
+            ((b0 == 0xf0) && (b1 < 0x90)) || ((b0 == 0xf4) && (b1 >= 0x90))) {
+            return 0;
+        }
+        return 4;
+    }
+    return 0;
+}
+
+namespace utf8 {
+
+// Reused from Boost
+inline bool invalid_continuing_octet(unsigned char octet_1)
+{
+    return (octet_1 < 0x80 || 0xbf < octet_1);
+}
+
+inline bool invalid_leading_octet(unsigned char octet_1)
+{
+    return (0x7f < octet_1 && octet_1 < 0xc0) || (octet_1 > 0xfd);
+}
+
+inline size_t backup_one_character_octect_count(unsigned char const *c, size_t max)
+{
+    size_t i = 1;
+    while (i != max) {
+        auto &ch = *(c - i);
+        if (!invalid_continuing_octet(ch)) {
+            ++i;
+            continue;
+        } else if (!invalid_leading_octet(ch)) {
+            break;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+// The length of the character that lead_octet starts. Bytes that cannot start
+// a well-formed character, continuation bytes among them, count as one.
+inline unsigned int get_octet_count(unsigned char lead_octet)
+{
+    if (0xc2 <= lead_octet && lead_octet <= 0xdf)
+        return 2;
+    else if (0xe0 <= lead_octet && lead_octet <= 0xef)
+        return 3;
+    else if (0xf0 <= lead_octet && lead_octet <= 0xf4)
+        return 4;
+    else
+        return 1;
+}
+
+// The length of the character at s[start] or, if it is malformed, of the
+// longest start of one that it has, which is at least a byte. So neither ASCII
+// nor the end of s is ever taken into a character. Encoded surrogates are
+// taken whole so that they can be escaped.
+inline size_t sequence_length(std::string_view const s, size_t start)
+{
+    auto const lead  = static_cast<unsigned char>(s[start]);
+    auto const count = get_octet_count(lead);
+    // The second byte's range rules out overlong forms and code points past
+    // U+10FFFF.
+    auto   low    = (lead == 0xe0) ? 0xa0u : (lead == 0xf0) ? 0x90u : 0x80u;
+    auto   high   = (lead == 0xf4) ? 0x8fu : 0xbfu;
+    size_t length = 1;
+    for (; (length < count) && (start + length < s.length()); ++length) {
+        auto const octet = static_cast<unsigned char>(s[start + length]);
+        if ((octet < low) || (high < octet)) {
+            break;
+        }
+        low  = 0x80;
+        high = 0xbf;
+    }
+    return length;
+}
+
+// Whether ch, as char_at() gives it, is ASCII or a whole character.
+inline bool is_well_formed(std::string_view const ch)
+{
+    auto const lead  = static_cast<unsigned char>(ch[0]);
+    auto const count = get_octet_count(lead);
+    return (lead <= 0x7f) || ((count > 1) && (ch.length() == count));
+}
+
+inline std::string_view char_at(std::string_view const s, size_t start)
+{
+    return s.substr(start, sequence_length(s, start));
+}
+
+inline uint32_t to_utf32(std::string_view s)
+{
+    constexpr uint8_t UTF8_ONE_BYTE_MASK   = 0b10000000;
+    constexpr uint8_t UTF8_TWO_BYTE_MASK   = 0b11100000;
+    constexpr uint8_t UTF8_THREE_BYTE_MASK = 0b11110000;
+    constexpr uint8_t UTF8_FOUR_BYTE_MASK  = 0b11111000;
+    constexpr uint8_t UTF8_FIVE_BYTE_MASK  = 0b11111100;
+
+    constexpr uint8_t UTF8_CONTINUATION_MASK = 0b00111111;
+
+    uint32_t c = 0;
+    switch (s.length()) {
+        case 1:
+            c = static_cast<uint8_t>(s[0]) & ~UTF8_ONE_BYTE_MASK;
+            break;
+        case 2:
+            c = static_cast<uint32_t>(static_cast<uint8_t>(s[0]) & ~UTF8_TWO_BYTE_MASK) << 6 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[1]) & UTF8_CONTINUATION_MASK);
+            break;
+        case 3:
+            c = static_cast<uint32_t>(static_cast<uint8_t>(s[0]) & ~UTF8_THREE_BYTE_MASK) << 12 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[1]) & UTF8_CONTINUATION_MASK) << 6 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[2]) & UTF8_CONTINUATION_MASK);
+            break;
+        case 4:
+            c = static_cast<uint32_t>(static_cast<uint8_t>(s[0]) & ~UTF8_FOUR_BYTE_MASK) << 18 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[1]) & UTF8_CONTINUATION_MASK) << 12 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[2]) & UTF8_CONTINUATION_MASK) << 6 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[3]) & UTF8_CONTINUATION_MASK);
+            break;
+        case 5:
+            c = static_cast<uint32_t>(static_cast<uint8_t>(s[0]) & ~UTF8_FIVE_BYTE_MASK) << 24 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[1]) & UTF8_CONTINUATION_MASK) << 18 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[2]) & UTF8_CONTINUATION_MASK) << 12 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[3]) & UTF8_CONTINUATION_MASK) << 6 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[4]) & UTF8_CONTINUATION_MASK);
+            break;
+        case 6:
+            c = static_cast<uint32_t>(static_cast<uint8_t>(s[0]) & ~UTF8_FIVE_BYTE_MASK) << 30 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[1]) & UTF8_CONTINUATION_MASK) << 24 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[2]) & UTF8_CONTINUATION_MASK) << 18 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[3]) & UTF8_CONTINUATION_MASK) << 12 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[4]) & UTF8_CONTINUATION_MASK) << 6 |
+                static_cast<uint32_t>(static_cast<uint8_t>(s[5]) & UTF8_CONTINUATION_MASK);
+            break;
+    }
+    return c;
+}
+
+} // namespace utf8
+
+} // namespace com::google::json::detail
+
+namespace com::google::json {
+
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::sanitize()
+{
+    startDocument();
+    sanitizeFrom(0u, State::START_ARRAY);
+}
+
+/// Clears what is left from any previous document.
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::startDocument() noexcept
+{
+    _bracketDepth = 0u;
+    _cleaned      = 0u;
+    _truncated    = false;
+    _sanitizedJson.clear();
+}
+
+/// Sanitizes the document from {\code _jsonish[i]} on, given the state there,
+/// and writes the output to the sink if there is one.
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::sanitizeFrom(size_t i, State state)
+{
+    // The repairs are counted for this document on its own, then added to the
+    // caller's stats and the process totals once it is done.
+    std::optional<SanitizeStats> documentStats;
+    auto *const                  callerStats = _stats;
+    if ((callerStats != nullptr) || RepairStatistics::enabled()) {
+        documentStats.emplace();
+        _stats = &*documentStats;
+    }
+    // If logging, trace the document unless the caller already is.
+    std::optional<SanitizeTrace> logTrace;
+    if constexpr (Policy::TRACE) {
+        if (_log && (_trace == nullptr)) {
+            logTrace.emplace();
+            _trace = &*logTrace;
+        }
+    }
+    struct Restore
+    {
+        BasicJsonSanitizer           &sanitizer;
+        SanitizeStats                *stats;
+        std::optional<SanitizeTrace> &logTrace;
+
+        // The log is written even if the document is too deeply nested.
+        ~Restore()
+        {
+            sanitizer._stats = stats;
+            if (logTrace) {
+                logTrace->dump(std::cerr);
+                sanitizer._trace = nullptr;
+            }
+        }
+    } restore{*this, callerStats, logTrace};
+
+    if (_jsonish.empty()) {
+        _sanitizedJson = "null";
+        noteRepair(Repair::NULL_ADDED, 4);
+    } else {
+        _index.reset(_jsonish);
+        sanitizeTokens(i, state, false);
+        completeDocument(state);
+    }
+    if (_sink != nullptr) {
+        drain(*_sink, _jsonish.length(), state, true);
+        _sink->flush();
+    }
+    if (documentStats) {
+        detail::recordStats(*documentStats, _jsonish.length(), callerStats);
+    }
+}
+
+/// Sanitizes the tokens from {\code _jsonish[i]} on. If partial is set more
+/// input may follow, so this stops at the first token whose output could still
+/// depend on it and returns its position. Otherwise returns the input length.
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::sanitizeTokens(size_t i, State &state, bool partial)
+{
+    auto const n = _jsonish.length();
+    // Most input is already valid JSON, so only start repairing from the
+    // first token that might need it.
+    i = endOfValidPrefix(i, state, partial);
+    trace(TraceEvent::VALID_PREFIX, i, state);
+    // Repairs to a token that is undone must not be counted twice.
+    std::optional<SanitizeStats> statsBefore;
+    // Whitespace is never rewritten, so step straight over it to the start of
+    // the next token. Each case below leaves i just past what it consumed.
+    for (; i < n; i = _index.nextNonWhitespace(i)) {
+        if (partial && (i + detail::TOKEN_LOOKAHEAD > n)) {
+            return i;
+        }
+        auto const ch          = _jsonish[i];
+        auto const tokenStart  = i;
+        auto const stateBefore = state;
+        auto const depthBefore = _bracketDepth;
+        auto const commaBefore = _pendingCommaOut;
+        auto const cleanBefore = _cleaned;
+        auto const outBefore   = _sanitizedJson.length();
+        if (partial && (_stats != nullptr)) {
+            statsBefore = *_stats;
+        }
+        trace(TraceEvent::TOKEN, i, state);
+        auto abortLoop = false;
+        if (detail::isAscii(ch)) {
+            switch (ch) {
+                case '"':
+                case '\'': {
+                    if (!advance(i, state, detail::Token::KEY_OR_VALUE)) {
+                        abortLoop = true;
+                        break;
+                    }
+                    auto strEnd = endOfQuotedString(i);
+                    sanitizeString(i, strEnd);
+                    i = strEnd;
+                } break;
+                case '(':
+                case ')':
+                    elide(i, i + 1);
+                    noteRepair(Repair::ELIDED, -1);
+                    ++i;
+                    break;
+                case '{':
+                case '[': {
+
+                    if (!advance(i, state, detail::Token::VALUE)) {
+                        abortLoop = true;
+                        break;
+                    }
+                    if (_bracketDepth >= static_cast<size_t>(_maximumNestingDepth)) {
+                        throw std::out_of_range{"Maximum nesting depth exceeded"};
+                    }
+                    auto map              = ch == '{';
+                    _isMap[_bracketDepth] = map;
+                    ++_bracketDepth;
+                    state = map ? State::START_MAP : State::START_ARRAY;
+                    ++i;
+                } break;
+                case '}':
+                case ']':
+                    if (_bracketDepth == 0) {
+                        abortLoop = true;
+                        break;
+                    }
+                    advance(i, state, detail::Token::CLOSE);
+                    --_bracketDepth;
+                    {
+                        auto closeBracket = _isMap[_bracketDepth] ? '}' : ']';
+                        if (ch != closeBracket) {
+                            replace(i, i + 1, closeBracket);
+                            noteRepair(Repair::BRACKET_CLOSED, 0);
+                        }
+                        state = ((_bracketDepth == 0) || (!_isMap[_bracketDepth - 1])) ?
+                                    State::AFTER_ELEMENT :
+                                    State::AFTER_VALUE;
+                    }
+                    ++i;
+                    break;
+                case ',':
+                    if (_bracketDepth == 0) {
+                        abortLoop = true;
+                        break;
+                    }
+                    advance(i, state, detail::Token::COMMA);
+                    ++i;
+                    break;
+                case ':':
+                    advance(i, state, detail::Token::COLON);
+                    ++i;
+                    break;
+                case '/': {
+
+                    auto end = i + 1;
+                    if (Policy::STRIP_COMMENTS && (end < n)) {
+                        switch (_jsonish[end]) {
+                            case '/':
+                                end = n; // Worst case.
+                                for (auto j = _index.nextLineBreak(i + 2); j < n;
+                                     j = _index.nextLineBreak(j + 1)) {
+                                    if ((_jsonish[j] == '\n') || (_jsonish[j] == '\r')) {
+                                        end = j + 1;
+                                        break;
+                                    }
+                                    auto const lineBreak = _jsonish.substr(j, 3);
+                                    if ((lineBreak == "\xe2\x80\xa8") || (lineBreak == "\xe2\x80\xa9")) {
+                                        end = j + 3;
+                                        break;
+                                    }
+                                }
+                                break;
+                            case '*':
+                                end = n;
+                                if (i + 3 < n) {
+                                    for (auto j = i + 2; (j = _jsonish.find('/', j + 1)) !=
+                                                         std::string_view::npos;) {
+                                        if (_jsonish[j - 1] == '*') {
+                                            end = j + 1;
+                                            break;
+                                        }
+                                    }
+                                }
+                                break;
+                            default:
+                                break;
+                        }
+                    }
+                    elide(i, end);
+                    // A lone slash is not a comment.
+                    noteRepair((end == i + 1) ? Repair::ELIDED : Repair::COMMENT,
+                               -static_cast<ptrdiff_t>(end - i));
+                    i = end;
+                } break;
+                default:
+                    // Three kinds of other values can occur.
+                    // 1. Numbers
+                    // 2. Keyword values ("false", "null", "true")
+                    // 3. Unquoted JS property names as in the JS expression
+                    //      ({ foo: "bar"})
+                    //    which is equivalent to the JSON
+                    //      { "foo": "bar" }
+                    // 4. Cruft tokens like BOMs.
+
+                    // Look for a run of '.', [0-9], [a-zA-Z_$], [+-] which subsumes
+                    // all the above without including any JSON special characters
+                    // outside keyword and number.
+                    auto runEnd = endOfRun(i);
+
+                    if (runEnd == i) {
+                        elide(i, i + 1);
+                        noteRepair(Repair::ELIDED, -1);
+                        ++i;
+                        break;
+                    }
+
+                    if (!advance(i, state, detail::Token::KEY_OR_VALUE)) {
+                        abortLoop = true;
+                        break;
+                    }
+                    // Without recoding, octal numbers are quoted like words.
+                    auto isNumber   = isMaybeNumeric(i, runEnd) &&
+                                    (Policy::RECODE_NUMBERS || !isOctalNumber(i, runEnd));
+                    auto bisKeyword = !isNumber && isKeyword(i, runEnd);
+
+                    if (!(isNumber || bisKeyword)) {
+                        // We're going to have to quote the output.  Further expand to
+                        // include more of an unquoted token in a string.
+                        runEnd = _index.nextJsonSpecial(runEnd);
+                        if ((runEnd < n) && (_jsonish[runEnd] == '"')) {
+                            ++runEnd;
+                        }
+                    }
+                    if (state == State::AFTER_KEY) {
+                        // We need to quote whatever we have since it is used as a
+                        // property name in a map and only quoted strings can be used that
+                        // way in JSON.
+                        auto const balance = outputBalance();
+                        insert(i, '"');
+                        if (Policy::CANONICALIZE_KEYS && isNumber) {
+                            // By JS rules,
+                            //   { .5e-1: "bar" }
+                            // is the same as
+                            //   { "0.05": "bar" }
+                            // because a number literal is converted to its string form
+                            // before being used as a property name.
+                            canonicalizeNumber(i, runEnd);
+                            // We intentionally ignore the return value of canonicalize.
+                            // Uncanonicalizable numbers just get put straight through as
+                            // string values.
+                            insert(runEnd, '"');
+                            noteRepair(Repair::KEY_CANONICALIZED, outputBalance() - balance);
+                        } else {
+                            noteRepair(Repair::QUOTES_ADDED, 1);
+                            sanitizeString(i, runEnd);
+                        }
+                    } else {
+                        if (isNumber) {
+                            // Convert hex and octal constants to decimal and ensure that
+                            // integer and fraction portions are not empty.
+                            auto const balance = outputBalance();
+                            auto const cleaned = _cleaned;
+                            normalizeNumber(i, runEnd);
+                            if ((_cleaned != cleaned) || (outputBalance() != balance)) {
+                                noteRepair(Repair::NUMBER_NORMALIZED, outputBalance() - balance);
+                            }
+                        } else if (!bisKeyword) {
+                            // Treat as an unquoted string literal.
+                            insert(i, '"');
+                            noteRepair(Repair::QUOTES_ADDED, 1);
+                            sanitizeString(i, runEnd);
+                        }
+                    }
+                    i = runEnd;
+                    break;
+            }
+        } else {
+            // Non-ASCII characters are only ever part of unquoted strings.
+            auto runEnd = endOfRun(i);
+
+            if (runEnd == i) {
+                // A surrogate or non-character can not start an unquoted
+                // string, so it is dropped.
+                auto const charEnd = i + detail::utf8::char_at(_jsonish, i).length();
+                elide(i, charEnd);
+                noteRepair(Repair::ELIDED, -static_cast<ptrdiff_t>(charEnd - i));
+                i = charEnd;
+                continue;
+            }
+            if (!advance(i, state, detail::Token::KEY_OR_VALUE)) {
+                // Everything after the first top-level value is discarded.
+                elide(i, n);
+                noteRepair(Repair::TRUNCATED, -static_cast<ptrdiff_t>(n - i));
+                _truncated = true;
+                return n;
+            }
+            // We're going to have to quote the output.  Further expand to
+            // include more of an unquoted token in a string.
+            runEnd = _index.nextJsonSpecial(runEnd);
+            if ((runEnd < n) && (_jsonish[runEnd] == '"')) {
+                ++runEnd;
+            }
+            // Treat as an unquoted string literal
+            insert(i, '"');
+            noteRepair(Repair::QUOTES_ADDED, 1);
+            sanitizeString(i, runEnd);
+            i = runEnd;
+        }
+        if (abortLoop) {
+            // Everything after the first top-level value is discarded.
+            elide(i, n);
+            noteRepair(Repair::TRUNCATED, -static_cast<ptrdiff_t>(n - i));
+            _truncated = true;
+            return n;
+        }
+        if (partial && (i + detail::TOKEN_LOOKAHEAD > n) && (ch != '}') && (ch != ']')) {
+            // The token may run on into input that has not arrived, so undo it
+            // and wait for more. Only a close bracket can have taken output back.
+            state            = stateBefore;
+            _bracketDepth    = depthBefore;
+            _pendingCommaOut = commaBefore;
+            _cleaned         = cleanBefore;
+            _sanitizedJson.resize(outBefore);
+            if (statsBefore) {
+                *_stats = *statsBefore;
+            }
+            return tokenStart;
+        }
+        if ((_sink != nullptr) && (_sanitizedJson.length() >= detail::SINK_CHUNK_SIZE)) {
+            drain(*_sink, i, state, false);
+        }
+    }
+    return n;
+}
+
+/// Closes off the document once all the input has been seen.
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::completeDocument(State state)
+{
+    auto const n = _jsonish.length();
+    trace(TraceEvent::COMPLETE, n, state);
+    if ((state == State::START_ARRAY) && (_bracketDepth == 0)) {
+        // No tokens.  Only whitespace
+        insert(n, "null");
+        noteRepair(Repair::NULL_ADDED, 4);
+        state = State::AFTER_ELEMENT;
+    }
+
+    if (!_sanitizedJson.empty() || (_cleaned != 0) || (_bracketDepth != 0)) {
+        _sanitizedJson.append(_jsonish.substr(_cleaned, n - _cleaned));
+        _cleaned = n;
+
+        switch (state) {
+            case State::BEFORE_ELEMENT:
+            case State::BEFORE_KEY:
+                elideTrailingComma();
+                break;
+            case State::AFTER_KEY:
+                _sanitizedJson.append(":null");
+                noteRepair(Repair::NULL_ADDED, 5);
+                break;
+            case State::BEFORE_VALUE:
+                _sanitizedJson.append("null");
+                noteRepair(Repair::NULL_ADDED, 4);
+                break;
+            default:
+                break;
+        }
+
+        // Insert brackets to close unclosed content.
+        auto const unclosed = _bracketDepth;
+        while (_bracketDepth != 0) {
+            _sanitizedJson.push_back(_isMap[--_bracketDepth] ? '}' : ']');
+        }
+        if (unclosed != 0) {
+            noteRepair(Repair::BRACKET_CLOSED, static_cast<ptrdiff_t>(unclosed), unclosed);
+        }
+    }
+}
+
+/// Writes the output for the input before {\code _jsonish[i]} that can no
+/// longer change to sink. Unless final, output from a pending comma on is held
+/// back since a close bracket would take it back. Spans of input that need no
+/// changes are written directly. Returns how much of the input is finished
+/// with.
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::drain(OutputSink &sink, size_t i, State state, bool final)
+{
+    auto const pendingComma =
+        !final && ((state == State::BEFORE_ELEMENT) || (state == State::BEFORE_KEY));
+
+    auto keep = i;
+    auto out  = _sanitizedJson.length();
+    if (pendingComma) {
+        if (out <= _pendingCommaOut) {
+            keep = _cleaned + (_pendingCommaOut - out);
+        } else {
+            out  = _pendingCommaOut;
+            keep = _cleaned;
+        }
+    }
+    if (out != 0) {
+        sink.write(std::string_view{_sanitizedJson}.substr(0, out));
+        _sanitizedJson.erase(0, out);
+    }
+    if (keep > _cleaned) {
+        sink.write(_jsonish.substr(_cleaned, keep - _cleaned));
+        _cleaned = keep;
+    }
+    if (pendingComma) {
+        // The comma is now the first thing still to be written.
+        _pendingCommaOut = 0;
+    }
+    return keep;
+}
+
+/// Runs over the longest stretch of input from {\code _jsonish[i]} that is
+/// strict JSON which needs no changes, moving state, the bracket stack and any
+/// pending comma on as sanitizeTokens() would. Returns the start of the first
+/// token that might need repair, or the input length. If partial is set, also
+/// stops at a token that ends too close to the end of the input to be sure of.
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::endOfValidPrefix(size_t i, State &state, bool partial)
+{
+    auto const n     = _jsonish.length();
+    auto const limit =
+        partial ? ((n > detail::TOKEN_LOOKAHEAD) ? n - detail::TOKEN_LOOKAHEAD : 0u) : n;
+    for (i = _index.nextNonWhitespace(i); i < n; i = _index.nextNonWhitespace(i)) {
+        auto const end = endOfValidToken(i, limit);
+        if ((end == i) || !acceptsToken(i, state)) {
+            return i;
+        }
+        i = end;
+    }
+    return n;
+}
+
+/// The end of the token at {\code _jsonish[i]}, or i if it is not strict JSON
+/// that sanitize() leaves alone wherever it appears, or if it ends past limit.
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::endOfValidToken(size_t i, size_t limit)
+{
+    switch (_jsonish[i]) {
+        case '"': {
+            auto const strEnd = endOfValidString(i);
+            return (strEnd > limit) ? i : strEnd;
+        }
+        case '{':
+        case '[':
+        case '}':
+        case ']':
+        case ',':
+        case ':':
+            return i + 1;
+        default: {
+            // Keywords and numbers. A non-ASCII character would be pulled
+            // into the run and turn it into an unquoted string.
+            auto const n      = _jsonish.length();
+            auto const runEnd = _index.nextNonWord(i);
+            if ((runEnd == i) || (runEnd > limit) ||
+                ((runEnd < n) && !detail::isAscii(_jsonish[runEnd])) ||
+                !(isKeyword(i, runEnd) || isJsonNumber(i, runEnd))) {
+                return i;
+            }
+            return runEnd;
+        }
+    }
+}
+
+/// Moves state, the bracket stack and any pending comma on for the token at
+/// {\code _jsonish[i]}, which endOfValidToken() has accepted. Returns false,
+/// changing nothing, if the token is out of place.
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::acceptsToken(size_t i, State &state)
+{
+    switch (_jsonish[i]) {
+        case '{':
+        case '[': {
+            if (detail::transition(state, detail::Token::VALUE).fix != detail::Fix::NONE) {
+                return false;
+            }
+            if (_bracketDepth >= static_cast<size_t>(_maximumNestingDepth)) {
+                return false;
+            }
+            auto const map        = _jsonish[i] == '{';
+            _isMap[_bracketDepth] = map;
+            ++_bracketDepth;
+            state = map ? State::START_MAP : State::START_ARRAY;
+            return true;
+        }
+        case '}':
+        case ']':
+            if ((_bracketDepth == 0) || ((_jsonish[i] == '}') != _isMap[_bracketDepth - 1])) {
+                return false;
+            }
+            if (detail::transition(state, detail::Token::CLOSE).fix != detail::Fix::NONE) {
+                return false;
+            }
+            --_bracketDepth;
+            state = ((_bracketDepth == 0) || (!_isMap[_bracketDepth - 1])) ? State::AFTER_ELEMENT :
+                                                                              State::AFTER_VALUE;
+            return true;
+        case ',':
+            if (_bracketDepth == 0) {
+                return false;
+            }
+            [[fallthrough]];
+        case ':': {
+            auto const token = (_jsonish[i] == ',') ? detail::Token::COMMA : detail::Token::COLON;
+            if (detail::transition(state, token).fix != detail::Fix::NONE) {
+                return false;
+            }
+            if (token == detail::Token::COMMA) {
+                notePendingComma(i);
+            }
+            state = detail::transition(state, token).next;
+            return true;
+        }
+        default:
+            return acceptsValue(state, _jsonish[i] == '"');
+    }
+}
+
+/// Splits the input from {\code _jsonish[i]} into the tokens that
+/// endOfValidPrefix() would check, without knowing the state there. i has to
+/// be where a token could start. The start of each token less base is added
+/// to tokens, stopping at the first token that starts at or past end, whose
+/// position is returned. A token that is not strict JSON is added and ends the
+/// scan, with invalid set.
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::scanValidTokens(size_t i, size_t end, size_t base,
+                                                   std::vector<uint32_t> &tokens, bool &invalid)
+{
+    auto const n = _jsonish.length();
+    invalid      = false;
+    for (i = _index.nextNonWhitespace(i); i < end; i = _index.nextNonWhitespace(i)) {
+        tokens.push_back(static_cast<uint32_t>(i - base));
+        auto const tokenEnd = endOfValidToken(i, n);
+        if (tokenEnd == i) {
+            invalid = true;
+            return i;
+        }
+        i = tokenEnd;
+    }
+    return i;
+}
+
+/// Accepts tokens found by scanValidTokens() as endOfValidPrefix() would.
+/// Returns the position of the first that is out of place, or SIZE_MAX.
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::acceptTokens(uint32_t const *first, uint32_t const *last,
+                                                size_t base, State &state)
+{
+    for (; first != last; ++first) {
+        auto const i = base + *first;
+        if (!acceptsToken(i, state)) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+/// Moves state on for a value that can be accepted as is. Returns false,
+/// leaving state alone, if sanitize() would have to insert a separator or key
+/// before the value, or quote it.
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::acceptsValue(State &state, bool canBeKey) const noexcept
+{
+    auto const next =
+        detail::transition(state, canBeKey ? detail::Token::KEY_OR_VALUE : detail::Token::VALUE);
+    if (next.fix != detail::Fix::NONE) {
+        return false;
+    }
+    state = next.next;
+    return true;
+}
+
+/// The position past the closing quote of the double quoted string starting
+/// at {\code _jsonish[start]}, or start if the string is not strict JSON or
+/// sanitizeString() would change it.
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::endOfValidString(size_t start)
+{
+    auto const n = _jsonish.length();
+    for (auto i = _index.nextStringSpecial<Policy::ESCAPE_EMBEDDING>(start + 1, n); i < n;
+         i      = _index.nextStringSpecial<Policy::ESCAPE_EMBEDDING>(i, n)) {
+        auto const ch = _jsonish[i];
+        if (ch == '"') {
+            return i + 1;
+        } else if (ch == '\\') {
+            if (i + 1 == n) {
+                return start;
+            }
+            switch (_jsonish[i + 1]) {
+                case '"':
+                case '\\':
+                case '/':
+                case 'b':
+                case 'f':
+                case 'n':
+                case 'r':
+                case 't':
+                    i += 2;
+                    break;
+                case 'u':
+                    if (!((i + 5 < n) && isHexAt(i + 2) && isHexAt(i + 3) && isHexAt(i + 4) &&
+                          isHexAt(i + 5))) {
+                        return start;
+                    }
+                    i += 6;
+                    break;
+                default:
+                    return start;
+            }
+        } else if (!detail::isAscii(ch)) {
+            auto const length = detail::plainUtf8Length(_jsonish, i);
+            if (length == 0) {
+                return start;
+            }
+            i += length;
+        } else if ((ch < '\x20') ||
+                   (Policy::ESCAPE_EMBEDDING && isEmbeddingHazardAt(i, start, n))) {
+            return start;
+        } else {
+            ++i;
+        }
+    }
+    return start;
+}
+
+/// Whether {\code _jsonish[start, end)} is a number in the form JSON requires,
+/// which normalizeNumber() leaves alone.
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::isJsonNumber(size_t start, size_t end) const
+{
+    auto pos = start;
+    if ((pos < end) && (_jsonish[pos] == '-')) {
+        ++pos;
+    }
+    auto const intEnd = endOfDigitRun(pos, end);
+    if ((intEnd == pos) || ((_jsonish[pos] == '0') && (intEnd - pos > 1))) {
+        return false;
+    }
+    pos = intEnd;
+    if ((pos < end) && (_jsonish[pos] == '.')) {
+        auto const fractionEnd = endOfDigitRun(pos + 1, end);
+        if (fractionEnd == pos + 1) {
+            return false;
+        }
+        pos = fractionEnd;
+    }
+    if ((pos < end) && ('e' == (_jsonish[pos] | 32))) {
+        ++pos;
+        if ((pos < end) && ((_jsonish[pos] == '+') || (_jsonish[pos] == '-'))) {
+            ++pos;
+        }
+        auto const expEnd = endOfDigitRun(pos, end);
+        if (expEnd == pos) {
+            return false;
+        }
+        pos = expEnd;
+    }
+    return pos == end;
+}
+
+template <typename Policy>
+std::variant<std::string_view, std::string> BasicJsonSanitizer<Policy>::toString() const noexcept
+{
+    return !_sanitizedJson.empty() ?
+               std::variant<std::string_view, std::string>{std::in_place_index<1>, _sanitizedJson} :
+               std::variant<std::string_view, std::string>{std::in_place_index<0>, _jsonish};
+}
+
+template <typename Policy>
+SanitizeResult BasicJsonSanitizer<Policy>::toResult() && noexcept
+{
+    return !_sanitizedJson.empty() ? SanitizeResult{std::move(_sanitizedJson)}
+                                   : SanitizeResult{_jsonish};
+}
+
+///
+/// Ensures that the output corresponding to {\code jsonish[start:end]} is a
+/// valid JSON string that has the same meaning when parsed by Javascript
+/// {\code eval}.
+/// <ul>
+///   <li>Making sure that it is fully quoted with double-quotes.
+///   <li>Escaping any Javascript newlines : CR, LF, U+2028, U+2029
+///   <li>Escaping HTML special characters to allow it to be safely embedded
+///       in HTML {\code <script>} elements and XML {\code <!CDATA[...]]>}
+///       sections.
+///   <li>Rewrite hex, octal, and other escapes that are valid in Javascript
+///       but not in JSON.
+/// </ul>
+/// \param start inclusive
+/// \param end   exclusive
+///
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::sanitizeString(size_t start, size_t end)
+{
+    auto closed = false;
+    // Only control characters, quotes, backslashes, '<', '>', ']' and non-ASCII
+    // characters can need rewriting. Everything between them is left in place
+    // and copied to the output in one go by the next replace() or insert().
+    for (auto i = _index.nextStringSpecial<Policy::ESCAPE_EMBEDDING>(start, end); i < end;
+         i      = _index.nextStringSpecial<Policy::ESCAPE_EMBEDDING>(i, end)) {
+        auto const ch = _jsonish[i];
+        if (!detail::isAscii(ch)) {
+            i = sanitizeNonAscii(i);
+            continue;
+        }
+        // Escape all control code-points and isolated surrogates which are
+        // not embeddable in XML.
+        // http://www.w3.org/TR/xml/#charsets says
+        //     Char ::= #x9 | #xA | #xD | [#x20-#xD7FF] | [#xE000-#xFFFD]
+        //            | [#x10000-#x10FFFF]
+        // Note - we deal with '\n' and '\r' separately
+        if (ch < '\x20') {
+            if ((ch == '\x09')) {
+                ++i;
+                continue;
+            } else if (!((ch == '\x0a') || (ch == '\x0d'))) {
+                replace(i, i + 1, "\\u");
+                auto uch = static_cast<uint32_t>(ch);
+                for (auto j = 4; --j >= 0;) {
+                    _sanitizedJson.push_back(detail::HEX_DIGITS[uch >> (j << 2) & 0x0f]);
+                }
+                noteRepair(Repair::CHARACTER_ESCAPED, 5);
+                ++i;
+                continue;
+            }
+        }
+        switch (ch) {
+            // Fix tabs in strings
+            case '\t':
+                replace(i, i + 1, "\\t");
+                noteRepair(Repair::CHARACTER_ESCAPED, 1);
+                break;
+            // Fixup newlines.
+            case '\n':
+                replace(i, i + 1, "\\n");
+                noteRepair(Repair::CHARACTER_ESCAPED, 1);
+                break;
+            case '\r':
+                replace(i, i + 1, "\\r");
+                noteRepair(Repair::CHARACTER_ESCAPED, 1);
+                break;
+            // String delimiting quotes that need to be converted : 'foo' -> "foo"
+            // or internal quotes that might need to be escaped : f"o -> f\"o.
+            case '"':
+            case '\'':
+                if (i == start) {
+                    if (ch == '\'') {
+                        // Counted once for the string; the closing quote is free.
+                        replace(i, i + 1, "\"");
+                        noteRepair(Repair::SINGLE_QUOTES, 0);
+                    }
+                } else {
+                    if ((i + 1) == end) {
+                        auto startDelim = _jsonish[start];
+                        if (startDelim != '\'') {
+                            // If we're sanitizing a string whose start was inferred, then
+                            // treat '"' as closing regardless.
+                            startDelim = '"';
+                        }
+                        closed = startDelim == ch;
+                    }
+                    if (closed) {
+                        if (ch == '\'') {
+                            replace(i, i + 1, "\"");
+                        }
+                    } else if (ch == '"') {
+                        insert(i, "\\");
+                        noteRepair(Repair::CHARACTER_ESCAPED, 1);
+                    }
+                }
+                break;
+            // Embedding. Disallow <script, </script, <!--, --> and ]]> in string
+            // literals so that the output can be embedded in HTML script elements
+            // and in XML CDATA sections without affecting the parser state.
+            // References:
+            // https://www.w3.org/TR/html53/semantics-scripting.html#restrictions-for-contents-of-script-elements
+            // https://www.w3.org/TR/html53/syntax.html#script-data-escaped-state
+            // https://www.w3.org/TR/html53/syntax.html#script-data-double-escaped-state
+            // https://www.w3.org/TR/xml/#sec-cdata-sect
+            case '<':
+                if (Policy::ESCAPE_EMBEDDING && isEmbeddingHazardAt(i, start, end)) {
+                    replace(i, i + 1, "\\u003c");
+                    noteRepair(Repair::EMBEDDING_ESCAPED, 5);
+                }
+                break;
+            case '>':
+                if (Policy::ESCAPE_EMBEDDING && isEmbeddingHazardAt(i, start, end)) {
+                    replace(i, i + 1, "\\u003e");
+                    noteRepair(Repair::EMBEDDING_ESCAPED, 5);
+                }
+                break;
+            case ']':
+                if (Policy::ESCAPE_EMBEDDING && isEmbeddingHazardAt(i, start, end)) {
+                    replace(i, i + 1, "\\u005d");
+                    noteRepair(Repair::EMBEDDING_ESCAPED, 5);
+                }
+                break;
+            // Normalize escape sequences.
+            case '\\':
+                if (i + 1 == end) {
+                    elide(i, i + 1);
+                    noteRepair(Repair::ESCAPE_REWRITTEN, -1);
+                    break;
+                }
+                if (auto const sch = _jsonish[i + 1]; detail::isAscii(sch)) {
+                    switch (sch) {
+                        case 'b':
+                        case 'f':
+                        case 'n':
+                        case 'r':
+                        case 't':
+                        case '\\':
+                        case '/':
+                        case '"':
+                            ++i;
+                            break;
+                        case 'x':
+                            if (((i + 4) < end) && isHexAt(i + 2) && isHexAt(i + 3)) {
+                                replace(i, i + 2, "\\u00"); // \xab -> \u00ab
+                                noteRepair(Repair::ESCAPE_REWRITTEN, 2);
+                                i += 3;
+                                break;
+                            }
+                            elide(i, i + 1);
+                            noteRepair(Repair::ESCAPE_REWRITTEN, -1);
+                            break;
+                        case 'u':
+                            if (((i + 6) < end) && isHexAt(i + 2) && isHexAt(i + 3) &&
+                                isHexAt(i + 4) && isHexAt(i + 5)) {
+                                i += 5;
+                                break;
+                            }
+                            elide(i, i + 1);
+                            noteRepair(Repair::ESCAPE_REWRITTEN, -1);
+                            break;
+                        case '0':
+                        case '1':
+                        case '2':
+                        case '3':
+                        case '4':
+                        case '5':
+                        case '6':
+                        case '7': {
+                            auto octalEnd = i + 1;
+                            if (((octalEnd + 1) < end) && isOctAt(octalEnd + 1)) {
+                                ++octalEnd;
+                                if (((ch <= '3')) && ((octalEnd + 1) < end) &&
+                                    isOctAt(octalEnd + 1)) {
+                                    ++octalEnd;
+                                }
+                                int value = 0;
+                                for (auto j = i; j < octalEnd; ++j) {
+                                    value = (value << 3) | (_jsonish[j] - '0');
+                                }
+                                replace(i + 1, octalEnd, "u00");
+                                appendHex(value, 2);
+                                noteRepair(Repair::ESCAPE_REWRITTEN,
+                                           5 - static_cast<ptrdiff_t>(octalEnd - i - 1));
+                            }
+                            i = octalEnd - 1;
+                        } break;
+                        default:
+                            elide(i, i + 1);
+                            noteRepair(Repair::ESCAPE_REWRITTEN, -1);
+                            break;
+                    }
+                } else {
+                    // Nothing non-ASCII can be escaped in JSON, so the backslash
+                    // goes and the character is dealt with on its own.
+                    elide(i, i + 1);
+                    noteRepair(Repair::ESCAPE_REWRITTEN, -1);
+                }
+                break;
+            default:
+                break;
+        }
+        ++i;
+    }
+    if (!closed) {
+        insert(end, "\"");
+        // The opening quote of an unquoted string was counted when it was added.
+        auto const quoted = (_jsonish[start] == '"') || (_jsonish[start] == '\'');
+        noteRepair(Repair::QUOTES_ADDED, 1, quoted ? 1 : 0);
+    }
+}
+
+/// Whether the '<', '>' or ']' at {\code _jsonish[i]}, in the string literal
+/// {\code _jsonish[start, end)}, is part of a sequence that must be broken up.
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::isEmbeddingHazardAt(size_t i, size_t start, size_t end) const
+{
+    switch (_jsonish[i]) {
+        case '<':
+            // Disallow <!--, which lets the HTML parser switch into the "script
+            // data escaped" state.
+            // Disallow <script, which followed by various characters lets the
+            // HTML parser switch into or out of the "script data double escaped"
+            // state.
+            // Disallow </script, which ends a script block.
+            if (i + 4 < end) {
+                auto const c1  = _jsonish[i + 1];
+                auto const lc1 = static_cast<char>(c1 | 32);
+                auto const c2  = _jsonish[i + 2];
+                auto const lc2 = static_cast<char>(c2 | 32);
+                auto const lc3 = static_cast<char>(_jsonish[i + 3] | 32);
+                return (c1 == '!' && c2 == '-' && _jsonish[i + 3] == '-') ||
+                       (lc1 == 's' && lc2 == 'c' && lc3 == 'r') ||
+                       (c1 == '/' && lc2 == 's' && lc3 == 'c');
+            }
+            return false;
+        case '>':
+            // Disallow -->, which lets the HTML parser switch out of the "script
+            // data escaped" or "script data double escaped" state.
+            return (i >= start + 2) && (_jsonish[i - 2] == '-') && (_jsonish[i - 1] == '-');
+        case ']':
+            // Disallow ]]>, which ends an XML CDATA section.
+            return (i + 2 < end) && (_jsonish[i + 1] == ']') && (_jsonish[i + 2] == '>');
+        default:
+            return false;
+    }
+}
+
+/// Handles the non-ASCII character starting at {\code _jsonish[i]} in a string
+/// literal and returns the position after it. U+2028 and U+2029 are escaped
+/// since they are not newlines in JSON but are unparseable by JS eval.
+/// Malformed UTF-8 is repaired one maximal sequence at a time if the policy
+/// asks for it, as the Unicode standard recommends.
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::sanitizeNonAscii(size_t i)
+{
+    auto const ch = detail::utf8::char_at(_jsonish, i);
+    if (!detail::utf8::is_well_formed(ch)) {
+        if constexpr (Policy::UTF8_REPAIR == Utf8Repair::REPLACE) {
+            replace(i, i + ch.length(), "\xef\xbf\xbd");
+            noteRepair(Repair::UTF8_REPLACED, 3 - static_cast<ptrdiff_t>(ch.length()));
+        } else if constexpr (Policy::UTF8_REPAIR == Utf8Repair::ESCAPE) {
+            replace(i, i + ch.length(), "\\ufffd");
+            noteRepair(Repair::UTF8_REPLACED, 6 - static_cast<ptrdiff_t>(ch.length()));
+        }
+    } else if (ch == "\xe2\x80\xa8") {
+        replace(i, i + ch.length(), "\\u2028");
+        noteRepair(Repair::CHARACTER_ESCAPED, 3);
+    } else if (ch == "\xe2\x80\xa9") {
+        replace(i, i + ch.length(), "\\u2029");
+        noteRepair(Repair::CHARACTER_ESCAPED, 3);
+    } else {
+        auto const u32ch = detail::utf8::to_utf32(ch);
+        if (((u32ch >= 0xD800) && (u32ch < 0xE000)) || (u32ch == 0xFFFE) || (u32ch == 0xFFFF)) {
+            // This must be a lone surrogate or BOM - otherwise it would have been
+            // combined with another surrogate to make a valid UTF8 character
+            replace(i, i + ch.length(), "\\u");
+            auto u16ch = static_cast<uint16_t>(u32ch); // Safe
+            for (int j = 4; --j >= 0;) {
+                _sanitizedJson.push_back(detail::HEX_DIGITS[(u16ch >> (j << 2)) & 0xf]);
+            }
+            noteRepair(Repair::SURROGATE_ESCAPED, 6 - static_cast<ptrdiff_t>(ch.length()));
+        }
+    }
+    return i + ch.length();
+}
+
+/// Moves state on for the token at {\code _jsonish[pos]}, making whatever
+/// repair the grammar calls for. Returns false, leaving state alone, if the
+/// token is a value that would follow a complete top-level value.
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::advance(size_t pos, State &state, detail::Token token)
+{
+    auto const next = detail::transition(state, token);
+    switch (next.fix) {
+        case detail::Fix::NONE:
+            break;
+        case detail::Fix::INSERT_NULL:
+            insert(pos, "null");
+            noteRepair(Repair::NULL_ADDED, 4);
+            break;
+        case detail::Fix::INSERT_COLON_NULL:
+            insert(pos, ":null");
+            noteRepair(Repair::NULL_ADDED, 5);
+            break;
+        case detail::Fix::INSERT_EMPTY_KEY:
+            insert(pos, "\"\":");
+            noteRepair(Repair::SEPARATOR_ADDED, 3);
+            break;
+        case detail::Fix::INSERT_COLON:
+            insert(pos, ':');
+            noteRepair(Repair::SEPARATOR_ADDED, 1);
+            break;
+        case detail::Fix::NEXT_ELEMENT:
+            if (_bracketDepth == 0) {
+                return false;
+            }
+            [[fallthrough]];
+        case detail::Fix::INSERT_COMMA:
+            insert(pos, ',');
+            noteRepair(Repair::SEPARATOR_ADDED, 1);
+            break;
+        case detail::Fix::INSERT_COMMA_EMPTY_KEY:
+            insert(pos, ",\"\":");
+            noteRepair(Repair::SEPARATOR_ADDED, 4);
+            break;
+        case detail::Fix::ELIDE_TOKEN:
+            elide(pos, pos + 1);
+            noteRepair((token == detail::Token::COMMA) ? Repair::COMMA_ELIDED : Repair::ELIDED, -1);
+            return true;
+        case detail::Fix::ELIDE_TRAILING_COMMA:
+            elideTrailingComma();
+            break;
+    }
+    if (token == detail::Token::COMMA) {
+        // Kept, so it may yet turn out to be a trailing comma.
+        notePendingComma(pos);
+    }
+    state = next.next;
+    return true;
+}
+
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::insert(size_t pos, std::string_view s)
+{
+    replace(pos, pos, s);
+}
+
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::insert(size_t pos, char s)
+{
+    replace(pos, pos, s);
+}
+
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::elide(size_t start, size_t end)
+{
+    if (_sanitizedJson.empty()) {
+        _sanitizedJson.reserve(_jsonish.length() + 32);
+    }
+    _sanitizedJson.append(_jsonish.substr(_cleaned, start - _cleaned));
+    _cleaned = end;
+}
+
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::replace(size_t start, size_t end, std::string_view s)
+{
+    elide(start, end);
+    _sanitizedJson.append(s);
+}
+
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::replace(size_t start, size_t end, char s)
+{
+    elide(start, end);
+    _sanitizedJson.push_back(s);
+}
+
+/// The position past the last character within the quotes of the quoted
+/// string starting at {\code _jsonish[start]}. Does not assume that the
+/// quoted string is properly closed.
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::endOfQuotedString(size_t start)
+{
+    auto const quotes = (_jsonish[start] == '"') ? &detail::BlockMasks::quote
+                                                 : &detail::BlockMasks::apostrophe;
+    auto       i      = _index.nextUnescaped(start + 1, quotes);
+    while (i < _jsonish.length()) {
+        // A quote after stray UTF-8 continuation bytes is escaped if the
+        // backslashes before those bytes are, so count them again here.
+        auto const prev = static_cast<unsigned char>(_jsonish[i - 1]);
+        if ((prev < 0x80) || (prev > 0xbf)) {
+            return i + 1;
+        }
+        auto slashRunStart =
+            i - detail::utf8::backup_one_character_octect_count(
+                    reinterpret_cast<unsigned char const *>(&_jsonish[i]), i - start);
+        auto nSlashes = 0;
+        while ((slashRunStart > start) && (_jsonish[slashRunStart] == '\\')) {
+            ++nSlashes;
+            slashRunStart -= 1;
+        }
+        if ((nSlashes & 1) == 0) {
+            return i + 1;
+        }
+        i = _index.nextUnescaped(i + 1, quotes);
+    }
+    return _jsonish.length();
+}
+
+/// Records the comma at {\code _jsonish[pos]} that leaves the sanitizer
+/// waiting for another element or key. The comma has not been copied to
+/// _sanitizedJson yet, but when it is it will land at _pendingCommaOut.
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::notePendingComma(size_t pos) noexcept
+{
+    _pendingCommaOut = _sanitizedJson.length() + (pos - _cleaned);
+}
+
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::elideTrailingComma()
+{
+    // Only whitespace, or content that has been elided, can follow the
+    // pending comma, so there is no need to look for it.
+    auto const copied = _sanitizedJson.length();
+    if (copied <= _pendingCommaOut) {
+        // Not copied yet, so it is as far past _cleaned as it will land past
+        // the end of _sanitizedJson.
+        auto const comma = _cleaned + (_pendingCommaOut - copied);
+        elide(comma, comma + 1);
+        noteRepair(Repair::COMMA_ELIDED, -1);
+    } else {
+        // Also drops any whitespace that followed the comma.
+        _sanitizedJson.resize(_pendingCommaOut);
+        noteRepair(Repair::COMMA_ELIDED, -static_cast<ptrdiff_t>(copied - _pendingCommaOut));
+    }
+}
+
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::normalizeNumber(size_t start, size_t end)
+{
+    auto pos = start;
+    // Sign
+    if (pos < end) {
+        switch (_jsonish[pos]) {
+            case '+':
+                elide(pos, pos + 1);
+                ++pos;
+                break;
+            case '-':
+                ++pos;
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Integer part
+    auto intEnd = endOfDigitRun(pos, end);
+    if (pos == intEnd) { // No empty integer parts allowed in JSON.
+        insert(pos, '0');
+    } else if (_jsonish[pos] == '0') {
+        auto    reencoded = false;
+        int64_t value     = 0;
+        if (((intEnd - pos) == 1) && (intEnd < end)) {
+            if ('x' == (_jsonish[intEnd] | 32)) { // Recode hex.
+                for (auto tintEnd = intEnd + 1; tintEnd < end;
+                     tintEnd += detail::utf8::sequence_length(_jsonish, tintEnd)) {
+                    auto nchf = _jsonish[tintEnd];
+                    if (!detail::isAscii(nchf)) {
+                        continue;
+                    }
+                    auto digVal = 0;
+                    if (detail::isClass(nchf, detail::DIGIT)) {
+                        digVal = nchf - '0';
+                    } else {
+                        nchf |= 32;
+                        if (('a' <= nchf) && (nchf <= 'f')) {
+                            digVal = nchf - ('a' - 10);
+                        } else {
+                            break;
+                        }
+                    }
+                    value = (value << 4) | digVal;
+                }
+                reencoded = true;
+            }
+        } else if (intEnd - pos > 1) { // Recode octal.
+            for (auto i = pos; i < intEnd; ++i) {
+                int digVal = _jsonish[i] - '0';
+                if (digVal < 0) {
+                    break;
+                }
+                value = (value << 3) | digVal;
+            }
+            reencoded = true;
+        }
+        if (reencoded) {
+            elide(pos, intEnd);
+            if (value < 0) {
+                // Underflow.
+                // Avoid multiple signs.
+                // Putting out the underflowed value is the least bad option.
+                //
+                // We could use BigInteger, but that won't help many clients,
+                // and there is a valid use case for underflow: hex-encoded uint64s.
+                //
+                // First, consume any sign so that we don't put out strings like
+                // --1
+                if (!_sanitizedJson.empty()) {
+                    auto const last = _sanitizedJson.back();
+                    if (last == '-' || last == '+') {
+                        _sanitizedJson.pop_back();
+                        if (last == '-') {
+                            value = -value;
+                        }
+                    }
+                }
+            }
+            _sanitizedJson.append(std::to_string(value));
+        }
+    }
+    pos = intEnd;
+
+    // Optional fraction.
+    if (pos < end) {
+        if (_jsonish[pos] == '.') {
+            ++pos;
+            auto fractionEnd = endOfDigitRun(pos, end);
+            if (fractionEnd == pos) {
+                insert(pos, '0');
+            }
+            // JS eval will discard digits after 24(?) but will not treat them as a
+            // syntax error, and JSON allows arbitrary length fractions.
+            pos = fractionEnd;
+        }
+    }
+
+    // Optional exponent.
+    if (pos < end) {
+        if ('e' == (_jsonish[pos] | 32)) {
+            ++pos;
+            if (pos < end) {
+                switch (_jsonish[pos]) {
+                    // JSON allows explicit + in exponent but not for number as a whole.
+                    case '+':
+                    case '-':
+                        ++pos;
+                        break;
+                    default:
+                        break;
+                }
+            }
+            // JSON allows leading zeros on exponent part.
+            auto expEnd = endOfDigitRun(pos, end);
+            if (expEnd == pos) {
+                insert(pos, '0');
+            }
+            pos = expEnd;
+        }
+    }
+    if (pos != end) {
+        elide(pos, end);
+    }
+}
+
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::canonicalizeNumber(size_t start, size_t end)
+{
+    elide(start, start);
+    auto sanStart = _sanitizedJson.length();
+
+    normalizeNumber(start, end);
+
+    // Ensure that the number is on the output buffer.  Since this method is
+    // only called when we are quoting a number that appears where a property
+    // name is expected, we can force the sanitized form to contain it without
+    // affecting the fast-track for already valid inputs.
+    elide(end, end);
+    auto sanEnd = _sanitizedJson.length();
+
+    return canonicalizeNumber(_sanitizedJson, sanStart, sanEnd);
+}
+
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::canonicalizeNumber(std::pmr::string &sanitizedJson,
+                                                    size_t sanStart, size_t sanEnd)
+{
+    // Now we perform several steps.
+    // 1. Convert from scientific notation to regular or vice-versa based on
+    //    normalized exponent.
+    // 2. Remove trailing zeroes from the fraction and truncate it to 24 digits.
+    // 3. Elide the fraction entirely if it is ".0".
+    // 4. Convert any 'E' that separates the exponent to lower-case.
+    // 5. Elide any minus sign on a zero value.
+    // to convert the number to its canonical JS string form.
+
+    // Figure out where the parts of the number start and end.
+    size_t intEnd, fractionStart, fractionEnd, expStart, expEnd;
+    size_t offset   = (sanitizedJson[sanStart] == '-') ? 1 : 0;
+    auto   intStart = sanStart + offset;
+    for (intEnd = intStart;
+         (intEnd < sanEnd) && detail::isClass(sanitizedJson[intEnd], detail::DIGIT); ++intEnd) {
+    }
+    if ((intEnd == sanEnd) ||
+        (detail::isAscii(sanitizedJson[intEnd]) && ('.' != sanitizedJson[intEnd]))) {
+        fractionStart = fractionEnd = intEnd;
+    } else {
+        fractionStart = intEnd + 1;
+        for (fractionEnd = fractionStart;
+             (fractionEnd < sanEnd) && detail::isClass(sanitizedJson[fractionEnd], detail::DIGIT);
+             ++fractionEnd) {
+        }
+    }
+    if (fractionEnd == sanEnd) {
+        expStart = expEnd = sanEnd;
+    } else {
+        assert('e' == (sanitizedJson[fractionEnd] | 32));
+        expStart = fractionEnd + 1;
+        if (sanitizedJson[expStart] == '+') {
+            ++expStart;
+        }
+        expEnd = sanEnd;
+    }
+
+    assert((intStart <= intEnd) && (intEnd <= fractionStart) && (fractionStart <= fractionEnd) &&
+           (fractionEnd <= expStart) && (expStart <= expEnd));
+
+    auto exp = 0;
+    if (expEnd != expStart) {
+        if (auto [p, ec] =
+                std::from_chars(&sanitizedJson[expStart], &sanitizedJson[expEnd], exp, 10);
+            ec != std::errc{}) {
+            return false;
+        }
+    }
+    // Numbered Comments below come from the EcmaScript 5 language specification
+    // section 9.8.1 : ToString Applied to the Number Type
+    // http://es5.github.com/#x9.8.1
+
+    // 5. let n, k, and s be integers such that k >= 1, 10k-1 <= s < 10k, the
+    // Number value for s * 10n-k is m, and k is as small as possible.
+    // Note that k is the number of digits in the decimal representation of s,
+    // that s is not divisible by 10, and that the least significant digit of s
+    // is not necessarily uniquely determined by these criteria.
+    auto n = exp; // Exponent
+
+    // s, the string of decimal digits in the representation of m are stored in
+    // sanitizedJson.substring(intStart).
+    // k, the number of digits in s is computed later.
+
+    // Leave only the number representation on the output buffer after intStart.
+    // This leaves any sign on the digit per
+    // 3. If m is less than zero, return the String concatenation of the
+    //    String "-" and ToString(-m).
+    auto sawDecimal     = false;
+    auto zero           = true;
+    auto digitOutPos    = intStart;
+    auto nZeroesPending = 0;
+    for (auto i = intStart; i < fractionEnd; i += detail::utf8::sequence_length(sanitizedJson, i)) {
+        auto digit = sanitizedJson[i];
+        if (!detail::isAscii(digit)) {
+            continue;
+        }
+        if (digit == '.') {
+            sawDecimal = true;
+            if (zero) {
+                nZeroesPending = 0;
+            }
+            continue;
+        }
+
+        if ((!zero || digit != '0') && !sawDecimal) {
+            ++n;
+        }
+
+        if (digit == '0') {
+            // Keep track of runs of zeros so that we can take them into account
+            // if we later see a non-zero digit.
+            ++nZeroesPending;
+        } else {
+            if (zero) { // First non-zero digit.
+                // Discard runs of zeroes at the front of the integer part, but
+                // any after the decimal point factor into the exponent, n.
+                if (sawDecimal) {
+                    n -= nZeroesPending;
+                }
+                nZeroesPending = 0;
+            }
+            zero = false;
+            while (nZeroesPending != 0 || digit != 0) {
+                char vdigit;
+                if (nZeroesPending == 0) {
+                    vdigit = digit;
+                    digit  = (char)0;
+                } else {
+                    vdigit = '0';
+                    --nZeroesPending;
+                }
+
+                // TODO: limit s to 21 digits?
+                sanitizedJson[digitOutPos++] = vdigit;
+            }
+        }
+    }
+    sanitizedJson.resize(digitOutPos);
+    // Number of digits in decimal representation of s.
+    auto const k = static_cast<int>(digitOutPos - intStart);
+
+    // Now we have computed n, k, and s as defined above.  Time to add decimal
+    // points, exponents, and leading zeroes per the rest of the JS number
+    // formatting specification.
+
+    if (zero) { // There are no non-zero decimal digits.
+        // 2. If m is +0 or -0, return the String "0".
+        sanitizedJson.resize(sanStart); // Elide any sign.
+        sanitizedJson.push_back('0');
+        return true;
+    }
+
+    // 6. If k <= n <= 21, return the String consisting of the k digits of the
+    // decimal representation of s (in order, with no leading zeroes),
+    // followed by n-k occurrences of the character '0'.
+    if ((k <= n) && (n <= 21)) {
+        for (auto i = k; i < n; ++i) {
+            sanitizedJson.push_back('0');
+        }
+
+        // 7. If 0 < n <= 21, return the String consisting of the most significant n
+        // digits of the decimal representation of s, followed by a decimal point
+        // '.', followed by the remaining k-n digits of the decimal representation
+        // of s.
+    } else if ((0 < n) && (n <= 21)) {
+        sanitizedJson.insert(std::next(std::cbegin(sanitizedJson), intStart + n), '.');
+
+        // 8. If -6 < n <= 0, return the String consisting of the character '0',
+        // followed by a decimal point '.', followed by -n occurrences of the
+        // character '0', followed by the k digits of the decimal representation of
+        // s.
+    } else if (-6 < n && n <= 0) {
+        auto tmp = std::string_view{"0.000000"}.substr(0, 2 - static_cast<intptr_t>(n));
+        sanitizedJson.insert(intStart, tmp.data(), tmp.size());
+    } else {
+
+        // 9. Otherwise, if k = 1, return the String consisting of the single
+        // digit of s, followed by lowercase character 'e', followed by a plus
+        // sign '+' or minus sign '-' according to whether n-1 is positive or
+        // negative, followed by the decimal representation of the integer
+        // abs(n-1) (with no leading zeros).
+        if (k == 1) {
+            // Sole digit already on sanitizedJson.
+
+            // 10. Return the String consisting of the most significant digit of the
+            // decimal representation of s, followed by a decimal point '.', followed
+            // by the remaining k-1 digits of the decimal representation of s,
+            // followed by the lowercase character 'e', followed by a plus sign '+'
+            // or minus sign '-' according to whether n-1 is positive or negative,
+            // followed by the decimal representation of the integer abs(n-1) (with
+            // no leading zeros).
+        } else {
+            sanitizedJson.insert(std::next(std::cbegin(sanitizedJson), intStart + 1), '.');
+        }
+        auto const nLess1 = n - 1;
+        sanitizedJson.push_back('e');
+        sanitizedJson.push_back((nLess1 < 0) ? '-' : '+');
+        sanitizedJson.append(std::to_string(std::abs(nLess1)));
+    }
+    return true;
+}
+
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::isKeyword(size_t start, size_t end) const
+{
+    switch (end - start) {
+        case 5:
+            return _jsonish.compare(start, 5, "false") == 0;
+        case 4:
+            return (_jsonish.compare(start, 4, "true") == 0) ||
+                   (_jsonish.compare(start, 4, "null") == 0);
+        default:
+            return false;
+    }
+}
+
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::isOctAt(size_t i) const
+{
+    return detail::isClass(_jsonish[i], detail::OCT_DIGIT);
+}
+
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::isHexAt(size_t i) const
+{
+    return detail::isClass(_jsonish[i], detail::HEX_DIGIT);
+}
+
+template <typename Policy>
+void BasicJsonSanitizer<Policy>::appendHex(int n, int nDigits)
+{
+    for (unsigned int i = 0, x = static_cast<unsigned int>(n);
+         i<static_cast<unsigned int>(nDigits); ++i, x >> 4) {
+        auto dig = static_cast<char>(x & 0xf);
+        _sanitizedJson.push_back(dig +
+                                 (dig < static_cast<char>(10) ? '0' : static_cast<char>('a' - 10)));
+    }
+}
+
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::endOfDigitRun(size_t start, size_t limit) const
+{
+    for (auto end = start; end < limit; ++end) {
+        if (!detail::isClass(_jsonish[end], detail::DIGIT)) {
+            return end;
+        }
+    }
+    return limit;
+}
+
+/// The end of the run of '.', [0-9], [a-zA-Z_$], [+-] and non-ASCII
+/// characters starting at {\code jsonish[start]}. Isolated surrogates and
+/// the non-characters U+FFFE and U+FFFF end the run.
+template <typename Policy>
+size_t BasicJsonSanitizer<Policy>::endOfRun(size_t start)
+{
+    auto const n = _jsonish.length();
+    // Only the characters the index could not vouch for are decoded.
+    auto i = _index.nextNonBareWord(start);
+    while ((i < n) && (static_cast<unsigned char>(_jsonish[i]) >= 0x80)) {
+        auto const ch    = detail::utf8::char_at(_jsonish, i);
+        auto const u32ch = detail::utf8::to_utf32(ch);
+        if (((u32ch >= 0xD800) && (u32ch < 0xE000)) || (u32ch == 0xFFFE) || (u32ch == 0xFFFF)) {
+            break;
+        }
+        i = _index.nextNonBareWord(i + ch.length());
+    }
+    return i;
+}
+
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::isMaybeNumeric(size_t start, size_t end) const
+{
+    for (; start < end; ++start) {
+        if (!detail::isClass(_jsonish[start], detail::NUMERIC)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Whether the number {\code _jsonish[start, end)} has a leading zero that
+/// normalizeNumber() would read as octal.
+template <typename Policy>
+bool BasicJsonSanitizer<Policy>::isOctalNumber(size_t start, size_t end) const
+{
+    if ((start < end) && ((_jsonish[start] == '-') || (_jsonish[start] == '+'))) {
+        ++start;
+    }
+    return (start + 1 < end) && (_jsonish[start] == '0') &&
+           detail::isClass(_jsonish[start + 1], detail::DIGIT);
+}
+
+} // namespace com::google::json
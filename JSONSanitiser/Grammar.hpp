@@ -0,0 +1,149 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The grammar the sanitizer repairs its input against, as a table of what to
+// do with each kind of token in each parser state. The table is built at
+// compile time, and every engine that walks the input looks tokens up in it
+// rather than spelling the grammar out again.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace com::google::json::detail {
+
+enum class State : uint8_t
+{
+    /**
+     * Immediately after '[' and
+     * {@link #BEFORE_ELEMENT before the first element}.
+     */
+    START_ARRAY,
+    /** Before a JSON value in an array or at the top level. */
+    BEFORE_ELEMENT,
+    /**
+     * After a JSON value in an array or at the top level, and before any
+     * following comma or close bracket.
+     */
+    AFTER_ELEMENT,
+    /** Immediately after '{' and {@link #BEFORE_KEY before the first key}. */
+    START_MAP,
+    /** Before a key in a key-value map. */
+    BEFORE_KEY,
+    /** After a key in a key-value map but before the required colon. */
+    AFTER_KEY,
+    /** Before a value in a key-value map. */
+    BEFORE_VALUE,
+    /**
+     * After a value in a key-value map but before any following comma or
+     * close bracket.
+     */
+    AFTER_VALUE
+};
+
+inline constexpr size_t STATES = static_cast<size_t>(State::AFTER_VALUE) + 1;
+
+/// The kinds of token the grammar tells apart.
+enum class Token : uint8_t
+{
+    KEY_OR_VALUE, ///< A string, or a word the sanitizer quotes, that can be a key as it is.
+    VALUE,        ///< An open bracket, or anything else that cannot be a key as it is.
+    CLOSE,        ///< ] or }.
+    COMMA,
+    COLON
+};
+
+inline constexpr size_t TOKENS = static_cast<size_t>(Token::COLON) + 1;
+
+/// The repair that makes a token fit where it is.
+enum class Fix : uint8_t
+{
+    NONE,
+    INSERT_NULL,            ///< null goes before the token.
+    INSERT_COLON_NULL,      ///< :null goes before the token.
+    INSERT_EMPTY_KEY,       ///< "": goes before the token.
+    INSERT_COLON,           ///< : goes before the token.
+    INSERT_COMMA,           ///< , goes before the token.
+    INSERT_COMMA_EMPTY_KEY, ///< ,"": goes before the token.
+    NEXT_ELEMENT,           ///< , goes before the token, or at the top level the document ends.
+    ELIDE_TOKEN,            ///< The token is dropped.
+    ELIDE_TRAILING_COMMA    ///< The comma before the token is dropped.
+};
+
+struct Transition
+{
+    State next; ///< The state after the token. A close bracket's comes from the bracket stack.
+    Fix   fix;
+};
+
+using TransitionTable = std::array<std::array<Transition, TOKENS>, STATES>;
+
+constexpr TransitionTable makeTransitions() noexcept
+{
+    TransitionTable table = {};
+    auto const      set   = [&table](State state, Token token, State next, Fix fix) {
+        table[static_cast<size_t>(state)][static_cast<size_t>(token)] = {next, fix};
+    };
+    for (size_t s = 0; s < STATES; ++s) {
+        auto const state = static_cast<State>(s);
+        // Colons out of place are dropped and close brackets are always taken.
+        set(state, Token::COLON, state, Fix::ELIDE_TOKEN);
+        set(state, Token::CLOSE, state, Fix::NONE);
+    }
+
+    // Arrays and the top level.
+    for (auto state : {State::START_ARRAY, State::BEFORE_ELEMENT}) {
+        set(state, Token::KEY_OR_VALUE, State::AFTER_ELEMENT, Fix::NONE);
+        set(state, Token::VALUE, State::AFTER_ELEMENT, Fix::NONE);
+        // Array elision.
+        set(state, Token::COMMA, State::BEFORE_ELEMENT, Fix::INSERT_NULL);
+    }
+    set(State::BEFORE_ELEMENT, Token::CLOSE, State::BEFORE_ELEMENT, Fix::ELIDE_TRAILING_COMMA);
+    set(State::AFTER_ELEMENT, Token::KEY_OR_VALUE, State::AFTER_ELEMENT, Fix::NEXT_ELEMENT);
+    set(State::AFTER_ELEMENT, Token::VALUE, State::AFTER_ELEMENT, Fix::NEXT_ELEMENT);
+    set(State::AFTER_ELEMENT, Token::COMMA, State::BEFORE_ELEMENT, Fix::NONE);
+
+    // Maps.
+    for (auto state : {State::START_MAP, State::BEFORE_KEY}) {
+        set(state, Token::KEY_OR_VALUE, State::AFTER_KEY, Fix::NONE);
+        set(state, Token::VALUE, State::AFTER_KEY, Fix::INSERT_EMPTY_KEY);
+        set(state, Token::COMMA, state, Fix::ELIDE_TOKEN);
+    }
+    set(State::BEFORE_KEY, Token::CLOSE, State::BEFORE_KEY, Fix::ELIDE_TRAILING_COMMA);
+    set(State::AFTER_KEY, Token::KEY_OR_VALUE, State::AFTER_VALUE, Fix::INSERT_COLON);
+    set(State::AFTER_KEY, Token::VALUE, State::AFTER_VALUE, Fix::INSERT_COLON);
+    set(State::AFTER_KEY, Token::CLOSE, State::AFTER_KEY, Fix::INSERT_COLON_NULL);
+    set(State::AFTER_KEY, Token::COMMA, State::AFTER_KEY, Fix::ELIDE_TOKEN);
+    set(State::AFTER_KEY, Token::COLON, State::BEFORE_VALUE, Fix::NONE);
+    set(State::BEFORE_VALUE, Token::KEY_OR_VALUE, State::AFTER_VALUE, Fix::NONE);
+    set(State::BEFORE_VALUE, Token::VALUE, State::AFTER_VALUE, Fix::NONE);
+    set(State::BEFORE_VALUE, Token::CLOSE, State::BEFORE_VALUE, Fix::INSERT_NULL);
+    // Supply the missing value.
+    set(State::BEFORE_VALUE, Token::COMMA, State::BEFORE_KEY, Fix::INSERT_NULL);
+    set(State::AFTER_VALUE, Token::KEY_OR_VALUE, State::AFTER_KEY, Fix::INSERT_COMMA);
+    set(State::AFTER_VALUE, Token::VALUE, State::AFTER_VALUE, Fix::INSERT_COMMA_EMPTY_KEY);
+    set(State::AFTER_VALUE, Token::COMMA, State::BEFORE_KEY, Fix::NONE);
+    return table;
+}
+
+inline constexpr TransitionTable TRANSITIONS = makeTransitions();
+
+constexpr Transition transition(State state, Token token) noexcept
+{
+    return TRANSITIONS[static_cast<size_t>(state)][static_cast<size_t>(token)];
+}
+
+} // namespace com::google::json::detail
@@ -17,18 +17,34 @@
 // as the character set. As far as possible the original source code has
 // been directly reused.
 
+#pragma once
+
 #include "jsonsanitiser_export.h"
+#include "Grammar.hpp"
+#include "OutputSink.hpp"
+#include "SanitizeResult.hpp"
+#include "SanitizeStats.hpp"
+#include "SanitizeTrace.hpp"
+#include "StructuralIndex.hpp"
 
 #include <algorithm>
+#include <bitset>
 #include <cstddef>
+#include <cstdint>
+#include <memory_resource>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
 namespace com::google::json {
 
+namespace detail {
+class ParallelScan;
+}
+
 class AssertionError final : public std::runtime_error
 {
 public:
@@ -53,32 +69,97 @@ public:
     {}
 };
 
-class JSONSANITISER_EXPORT JsonSanitizer final
+/// What the sanitizer does with bytes that are not well-formed UTF-8.
+enum class Utf8Repair
 {
-    std::string_view  _jsonish;
-    int               _maximumNestingDepth           = MAXIMUM_NESTING_DEPTH;
-    bool              SUPER_VERBOSE_AND_SLOW_LOGGING = false;
-    std::string       _sanitizedJson;
-    size_t            _bracketDepth = 0;
-    size_t            _cleaned      = 0;
-    std::vector<bool> _isMap;
+    NONE,    ///< They are copied through. The input is trusted to be UTF-8.
+    REPLACE, ///< Each maximal malformed sequence becomes U+FFFD.
+    ESCAPE   ///< Each maximal malformed sequence becomes \ufffd.
+};
 
-public:
-    static inline constexpr int DEFAULT_NESTING_DEPTH = 64;
+/// The features of the sanitizer that are chosen when it is compiled. A
+/// policy of your own can derive from this and turn off what its input never
+/// needs, then be used to instantiate BasicJsonSanitizer.
+struct DefaultSanitizerPolicy
+{
+    /// Break up <!--, <script, </script, --> and ]]> in strings so that the
+    /// output can be embedded in HTML script elements and XML CDATA sections.
+    static inline constexpr bool ESCAPE_EMBEDDING = true;
+    /// Drop JavaScript comments. Without this a '/' is dropped on its own and
+    /// the text of a comment is sanitized like any other.
+    static inline constexpr bool STRIP_COMMENTS = true;
+    /// Quote numeric keys in the form JavaScript converts them to, so that
+    /// {.5e-1: 1} becomes {"0.05": 1}. Without this they are quoted as written.
+    static inline constexpr bool CANONICALIZE_KEYS = true;
+    /// Recode octal integers such as 017 in decimal. Without this they are
+    /// quoted as strings.
+    static inline constexpr bool RECODE_NUMBERS = true;
+    /// Repair malformed UTF-8 in strings, so that the output is valid UTF-8
+    /// without a separate validation pass.
+    static inline constexpr Utf8Repair UTF8_REPAIR = Utf8Repair::NONE;
+    /// Record what is done in a SanitizeTrace set on the sanitizer.
+    static inline constexpr bool TRACE = TRACING;
+    /// The deepest nesting that can be allowed. A bit per level is kept
+    /// inside the sanitizer.
     static inline constexpr int MAXIMUM_NESTING_DEPTH = 4096;
+};
 
-    JsonSanitizer(std::string_view jsonish) noexcept
+/// For output that only goes to API clients and is never embedded in HTML or
+/// XML.
+struct ApiSanitizerPolicy : DefaultSanitizerPolicy
+{
+    static inline constexpr bool ESCAPE_EMBEDDING = false;
+};
+
+template <typename Policy>
+class BasicJsonSanitizer final
+{
+    std::string_view                           _jsonish;
+    int                                        _maximumNestingDepth = MAXIMUM_NESTING_DEPTH;
+    bool                                       _log                 = false;
+    std::pmr::string                           _sanitizedJson;
+    size_t                                     _bracketDepth    = 0;
+    size_t                                     _cleaned         = 0;
+    size_t                                     _pendingCommaOut = 0;
+    bool                                       _truncated       = false;
+    std::bitset<Policy::MAXIMUM_NESTING_DEPTH> _isMap;
+    detail::StructuralIndex                    _index;
+    OutputSink                                *_sink  = nullptr;
+    SanitizeStats                             *_stats = nullptr;
+    SanitizeTrace                             *_trace = nullptr;
+
+    friend class JsonSanitizerStream;
+    friend class SanitizerContext;
+    friend class SanitizeTrace;
+    friend class detail::ParallelScan;
+
+public:
+    static inline constexpr int MAXIMUM_NESTING_DEPTH = Policy::MAXIMUM_NESTING_DEPTH;
+    static inline constexpr int DEFAULT_NESTING_DEPTH = std::min(64, MAXIMUM_NESTING_DEPTH);
+
+    BasicJsonSanitizer(std::string_view jsonish) noexcept
         : _jsonish{jsonish}
     {}
 
-    JsonSanitizer(std::string_view jsonish, int maximumNestingDepth, bool log) noexcept
+    /// If log is set and the library is built with JSONSANITISER_TRACE, a trace
+    /// of each document is written to std::cerr once it is sanitized.
+    BasicJsonSanitizer(std::string_view jsonish, int maximumNestingDepth, bool log) noexcept
         : _jsonish{jsonish}
         , _maximumNestingDepth{std::min(std::max(1, maximumNestingDepth), MAXIMUM_NESTING_DEPTH)}
-        , SUPER_VERBOSE_AND_SLOW_LOGGING{log}
+        , _log{log}
     {}
 
-    JsonSanitizer(std::string_view jsonish, int maximumNestingDepth) noexcept
-        : JsonSanitizer{jsonish, maximumNestingDepth, false}
+    BasicJsonSanitizer(std::string_view jsonish, int maximumNestingDepth) noexcept
+        : BasicJsonSanitizer{jsonish, maximumNestingDepth, false}
+    {}
+
+    /// The output buffer is allocated from resource.
+    BasicJsonSanitizer(std::string_view jsonish, int maximumNestingDepth, bool log,
+                       std::pmr::memory_resource *resource) noexcept
+        : _jsonish{jsonish}
+        , _maximumNestingDepth{std::min(std::max(1, maximumNestingDepth), MAXIMUM_NESTING_DEPTH)}
+        , _log{log}
+        , _sanitizedJson{resource}
     {}
 
     int getMaximumNestingDepth() const noexcept
@@ -96,45 +177,80 @@ public:
                                                                 int  maximumNestingDepth,
                                                                 bool log = false)
     {
-        JsonSanitizer s{jsonish, maximumNestingDepth, log};
+        BasicJsonSanitizer s{jsonish, maximumNestingDepth, log};
         s.sanitize();
         return s.toString();
     }
 
+    /// Like sanitize, but the output is moved out of the sanitizer rather than
+    /// copied, and the result says whether it is a view of jsonish.
+    static SanitizeResult sanitizeToResult(std::string_view jsonish, bool log = false)
+    {
+        return sanitizeToResult(jsonish, DEFAULT_NESTING_DEPTH, log);
+    }
+
+    static SanitizeResult sanitizeToResult(std::string_view jsonish, int maximumNestingDepth,
+                                           bool log = false)
+    {
+        BasicJsonSanitizer s{jsonish, maximumNestingDepth, log};
+        s.sanitize();
+        return std::move(s).toResult();
+    }
+
+    /// Like sanitizeToResult, but any output the result owns is allocated from
+    /// resource, which has to outlive the result.
+    static SanitizeResult sanitizeToResult(std::string_view           jsonish,
+                                           std::pmr::memory_resource *resource,
+                                           int  maximumNestingDepth = DEFAULT_NESTING_DEPTH,
+                                           bool log                 = false)
+    {
+        BasicJsonSanitizer s{jsonish, maximumNestingDepth, log, resource};
+        s.sanitize();
+        return std::move(s).toResult();
+    }
+
+    /// Like sanitizeToResult, and adds the repairs made to stats.
+    static SanitizeResult sanitizeToResult(std::string_view jsonish, SanitizeStats &stats,
+                                           int  maximumNestingDepth = DEFAULT_NESTING_DEPTH,
+                                           bool log                 = false)
+    {
+        BasicJsonSanitizer s{jsonish, maximumNestingDepth, log};
+        s._stats = &stats;
+        s.sanitize();
+        return std::move(s).toResult();
+    }
+
+    /// Writes the sanitized form of jsonish to sink rather than returning it.
+    static void sanitize(std::string_view jsonish, OutputSink &sink,
+                         int maximumNestingDepth = DEFAULT_NESTING_DEPTH, bool log = false)
+    {
+        BasicJsonSanitizer s{jsonish, maximumNestingDepth, log};
+        s._sink = &sink;
+        s.sanitize();
+    }
+
+    /// The repairs made by later calls to sanitize() are added to stats, if it
+    /// is not null.
+    void setStats(SanitizeStats *stats) noexcept
+    {
+        _stats = stats;
+    }
+
+    /// Later calls to sanitize() record what they do in trace, if it is not
+    /// null and the library is built with JSONSANITISER_TRACE.
+    void setTrace(SanitizeTrace *trace) noexcept
+    {
+        _trace = trace;
+    }
+
     void                                        sanitize();
     std::variant<std::string_view, std::string> toString() const noexcept;
+    SanitizeResult                              toResult() && noexcept;
 
 private:
-    enum class State
-    {
-        /**
-         * Immediately after '[' and
-         * {@link #BEFORE_ELEMENT before the first element}.
-         */
-        START_ARRAY,
-        /** Before a JSON value in an array or at the top level. */
-        BEFORE_ELEMENT,
-        /**
-         * After a JSON value in an array or at the top level, and before any
-         * following comma or close bracket.
-         */
-        AFTER_ELEMENT,
-        /** Immediately after '{' and {@link #BEFORE_KEY before the first key}. */
-        START_MAP,
-        /** Before a key in a key-value map. */
-        BEFORE_KEY,
-        /** After a key in a key-value map but before the required colon. */
-        AFTER_KEY,
-        /** Before a value in a key-value map. */
-        BEFORE_VALUE,
-        /**
-         * After a value in a key-value map but before any following comma or
-         * close bracket.
-         */
-        AFTER_VALUE
-    };
-
-    std::string toString(State const &s) const noexcept
+    using State = detail::State;
+
+    static char const *toString(State s) noexcept
     {
         switch (s) {
             case State::START_ARRAY:
@@ -167,24 +283,131 @@ private:
         }
     }
 
+    void noteRepair(Repair repair, ptrdiff_t bytesAdded, uint64_t times = 1) noexcept
+    {
+        if (_stats != nullptr) {
+            _stats->note(repair, bytesAdded, times);
+        }
+        if constexpr (Policy::TRACE) {
+            if ((_trace != nullptr) && (times != 0)) {
+                _trace->recordRepair(repair);
+            }
+        }
+    }
+
+    void trace(TraceEvent event, size_t i, State state) noexcept
+    {
+        if constexpr (Policy::TRACE) {
+            if (_trace != nullptr) {
+                auto const byte = (i < _jsonish.length()) ? _jsonish[i] : '\0';
+                _trace->record(event, i, static_cast<uint8_t>(byte), static_cast<uint8_t>(state));
+            }
+        }
+    }
+
+    /// What the repairs so far have added to the output. Only differences
+    /// within a token mean anything, since draining to a sink resets it.
+    ptrdiff_t outputBalance() const noexcept
+    {
+        return static_cast<ptrdiff_t>(_sanitizedJson.length()) - static_cast<ptrdiff_t>(_cleaned);
+    }
+
+    void   startDocument() noexcept;
+    void   sanitizeFrom(size_t i, State state);
+    size_t sanitizeTokens(size_t i, State &state, bool partial);
+    void   completeDocument(State state);
+    size_t drain(OutputSink &sink, size_t i, State state, bool final);
+    size_t endOfValidPrefix(size_t i, State &state, bool partial);
+    size_t endOfValidToken(size_t i, size_t limit);
+    bool   acceptsToken(size_t i, State &state);
+    size_t scanValidTokens(size_t i, size_t end, size_t base, std::vector<uint32_t> &tokens,
+                           bool &invalid);
+    size_t acceptTokens(uint32_t const *first, uint32_t const *last, size_t base, State &state);
+    bool   acceptsValue(State &state, bool canBeKey) const noexcept;
+    size_t endOfValidString(size_t start);
+    bool   isJsonNumber(size_t start, size_t end) const;
     void   sanitizeString(size_t start, size_t end);
-    State  requireValueState(size_t pos, State state, bool canBeKey);
+    bool   isEmbeddingHazardAt(size_t i, size_t start, size_t end) const;
+    size_t sanitizeNonAscii(size_t i);
+    bool   advance(size_t pos, State &state, detail::Token token);
     void   insert(size_t pos, std::string_view s);
     void   insert(size_t pos, char s);
     void   elide(size_t start, size_t end);
     void   replace(size_t start, size_t end, std::string_view s);
     void   replace(size_t start, size_t end, char s);
-    size_t endOfQuotedString(std::string_view s, size_t start) const;
-    void   elideTrailingComma(size_t closeBracketPos);
+    size_t endOfQuotedString(size_t start);
+    void   notePendingComma(size_t pos) noexcept;
+    void   elideTrailingComma();
     void   normalizeNumber(size_t start, size_t end);
     bool   canonicalizeNumber(size_t start, size_t end);
-    bool   canonicalizeNumber(std::string &sanitizedJson, size_t sanStart, size_t sanEnd);
+    bool   canonicalizeNumber(std::pmr::string &sanitizedJson, size_t sanStart, size_t sanEnd);
     bool   isKeyword(size_t start, size_t end) const;
     bool   isOctAt(size_t i) const;
     bool   isHexAt(size_t i) const;
-    bool   isJsonSpecialChar(size_t i) const;
     void   appendHex(int n, int nDigits);
     size_t endOfDigitRun(size_t start, size_t limit) const;
+    size_t endOfRun(size_t start);
     bool   isMaybeNumeric(size_t start, size_t end) const;
+    bool   isOctalNumber(size_t start, size_t end) const;
+};
+
+using JsonSanitizer    = BasicJsonSanitizer<DefaultSanitizerPolicy>;
+using ApiJsonSanitizer = BasicJsonSanitizer<ApiSanitizerPolicy>;
+
+// Built into the library. Sanitizers with other policies need
+// BasicJsonSanitizer.hpp.
+extern template class JSONSANITISER_EXPORT BasicJsonSanitizer<DefaultSanitizerPolicy>;
+extern template class JSONSANITISER_EXPORT BasicJsonSanitizer<ApiSanitizerPolicy>;
+
+/// Sanitizes a document that arrives in chunks, such as a request body read
+/// from a socket. Output is handed back as soon as no later input can change
+/// it, and put together is the same as {\code JsonSanitizer::sanitize} gives
+/// for the whole document. Between calls only the token that is still being
+/// read, any whitespace after a trailing comma and the open brackets are held.
+class JSONSANITISER_EXPORT JsonSanitizerStream final
+{
+    JsonSanitizer        _sanitizer;
+    JsonSanitizer::State _state = JsonSanitizer::State::START_ARRAY;
+    std::string          _pending;
+    size_t               _next    = 0;
+    size_t               _retryAt = 0;
+    std::string          _output;
+    size_t               _inputLength = 0;
+    SanitizeStats        _stats; ///< Repairs to this document, kept if RepairStatistics is on.
+
+public:
+    JsonSanitizerStream() noexcept
+        : JsonSanitizerStream{JsonSanitizer::DEFAULT_NESTING_DEPTH}
+    {}
+
+    explicit JsonSanitizerStream(int maximumNestingDepth, bool log = false) noexcept
+        : _sanitizer{std::string_view{}, maximumNestingDepth, log}
+    {}
+
+    /// Adds the next chunk of the document and returns the output that is now
+    /// final. The result is only valid until the next call.
+    std::string_view feed(std::string_view chunk);
+
+    /// Adds the next chunk of the document and writes the output that is now
+    /// final to sink.
+    void feed(std::string_view chunk, OutputSink &sink);
+
+    /// Ends the document and returns the rest of the output. The stream can
+    /// then be fed the next document.
+    std::string_view finish();
+
+    /// Ends the document and writes the rest of the output to sink.
+    void finish(OutputSink &sink);
+
+    /// Later input is recorded in trace, if it is not null and the library is
+    /// built with JSONSANITISER_TRACE. Offsets are from the start of the
+    /// document being streamed.
+    void setTrace(SanitizeTrace *trace) noexcept
+    {
+        _sanitizer._trace = trace;
+    }
+
+private:
+    void dropInput(size_t keep) noexcept;
 };
 } // namespace com::google::json
\ No newline at end of file
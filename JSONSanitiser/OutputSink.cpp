@@ -0,0 +1,104 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "OutputSink.hpp"
+
+#include <cerrno>
+#include <ostream>
+#include <system_error>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace com::google::json {
+
+void StringSink::write(std::string_view s)
+{
+    _out.append(s);
+}
+
+void BufferSink::write(std::string_view s)
+{
+    if (_size < _capacity) {
+        auto const n = std::min(s.length(), _capacity - _size);
+        std::copy_n(s.data(), n, _buffer + _size);
+    }
+    _size += s.length();
+}
+
+void OstreamSink::write(std::string_view s)
+{
+    _stream.write(s.data(), static_cast<std::streamsize>(s.length()));
+}
+
+void OstreamSink::flush()
+{
+    _stream.flush();
+}
+
+FdSink::~FdSink()
+{
+    try {
+        flush();
+    } catch (std::system_error const &) {
+    }
+}
+
+void FdSink::write(std::string_view s)
+{
+    if (_buffer.length() + s.length() < _flushThreshold) {
+        _buffer.append(s);
+        return;
+    }
+    flush();
+    if (s.length() < _flushThreshold) {
+        _buffer.append(s);
+    } else {
+        // Large pieces, typically unchanged input, go straight out.
+        writeAll(s);
+    }
+}
+
+void FdSink::flush()
+{
+    writeAll(_buffer);
+    _buffer.clear();
+}
+
+void FdSink::writeAll(std::string_view s)
+{
+    while (!s.empty()) {
+#if defined(_WIN32)
+        auto const n = ::_write(_fd, s.data(), static_cast<unsigned int>(s.length()));
+#else
+        auto const n = ::write(_fd, s.data(), s.length());
+#endif
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error{errno, std::generic_category(), "FdSink write"};
+        }
+        s.remove_prefix(static_cast<size_t>(n));
+    }
+}
+
+void CallbackSink::write(std::string_view s)
+{
+    _callback(s);
+}
+
+} // namespace com::google::json
@@ -0,0 +1,171 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Destinations for sanitized output. The sanitizer writes to a sink in pieces
+// as the output becomes final. Spans of the input that need no changes are
+// written straight from the input rather than copied into a string first.
+
+#pragma once
+
+#include "jsonsanitiser_export.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace com::google::json {
+
+/// Receives sanitized output, in order.
+class JSONSANITISER_EXPORT OutputSink
+{
+public:
+    virtual ~OutputSink() = default;
+
+    virtual void write(std::string_view s) = 0;
+
+    /// Called once the whole document has been written.
+    virtual void flush() {}
+};
+
+/// Appends to a caller-owned string.
+class JSONSANITISER_EXPORT StringSink final : public OutputSink
+{
+    std::string &_out;
+
+public:
+    explicit StringSink(std::string &out) noexcept
+        : _out{out}
+    {}
+
+    void write(std::string_view s) override;
+};
+
+/// Writes into a caller-owned buffer of fixed size. Output that does not fit
+/// is dropped but still counted, so size() says how big the buffer needed to
+/// be.
+class JSONSANITISER_EXPORT BufferSink final : public OutputSink
+{
+    char  *_buffer;
+    size_t _capacity;
+    size_t _size = 0;
+
+public:
+    BufferSink(char *buffer, size_t capacity) noexcept
+        : _buffer{buffer}
+        , _capacity{capacity}
+    {}
+
+    void write(std::string_view s) override;
+
+    size_t size() const noexcept
+    {
+        return _size;
+    }
+
+    bool overflowed() const noexcept
+    {
+        return _size > _capacity;
+    }
+
+    /// The output that fitted in the buffer.
+    std::string_view view() const noexcept
+    {
+        return {_buffer, std::min(_size, _capacity)};
+    }
+};
+
+/// Copies to an output iterator, such as a std::back_insert_iterator.
+template <typename OutputIt>
+class OutputIteratorSink final : public OutputSink
+{
+    OutputIt _it;
+
+public:
+    explicit OutputIteratorSink(OutputIt it)
+        : _it{it}
+    {}
+
+    void write(std::string_view s) override
+    {
+        _it = std::copy(s.begin(), s.end(), _it);
+    }
+
+    OutputIt iterator() const
+    {
+        return _it;
+    }
+};
+
+/// Writes to a std::ostream.
+class JSONSANITISER_EXPORT OstreamSink final : public OutputSink
+{
+    std::ostream &_stream;
+
+public:
+    explicit OstreamSink(std::ostream &stream) noexcept
+        : _stream{stream}
+    {}
+
+    void write(std::string_view s) override;
+    void flush() override;
+};
+
+/// Writes to a file descriptor. Small pieces are gathered and written once
+/// flushThreshold bytes are waiting, so a mostly unchanged document costs a
+/// handful of system calls. Throws std::system_error if a write fails.
+class JSONSANITISER_EXPORT FdSink final : public OutputSink
+{
+    int         _fd;
+    size_t      _flushThreshold;
+    std::string _buffer;
+
+public:
+    static inline constexpr size_t DEFAULT_FLUSH_THRESHOLD = 64 * 1024;
+
+    explicit FdSink(int fd, size_t flushThreshold = DEFAULT_FLUSH_THRESHOLD) noexcept
+        : _fd{fd}
+        , _flushThreshold{flushThreshold}
+    {}
+
+    FdSink(FdSink const &) = delete;
+    FdSink &operator=(FdSink const &) = delete;
+
+    /// Writes anything still waiting, ignoring errors.
+    ~FdSink() override;
+
+    void write(std::string_view s) override;
+    void flush() override;
+
+private:
+    void writeAll(std::string_view s);
+};
+
+/// Hands each piece to a callback.
+class JSONSANITISER_EXPORT CallbackSink final : public OutputSink
+{
+    std::function<void(std::string_view)> _callback;
+
+public:
+    explicit CallbackSink(std::function<void(std::string_view)> callback) noexcept
+        : _callback{std::move(callback)}
+    {}
+
+    void write(std::string_view s) override;
+};
+
+} // namespace com::google::json
@@ -0,0 +1,393 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "SanitizeBatch.hpp"
+#include "SanitizerContext.hpp"
+#include "WorkStealingPool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace com::google::json {
+
+namespace detail {
+
+/// Finds the valid prefix of one document on several threads.
+///
+/// The document is cut into chunks and the tokens in each chunk are found in
+/// parallel. Which bytes are tokens depends on where the previous chunk's last
+/// token ends, which is not known yet, so each chunk is scanned twice: once
+/// as if a token starts at the chunk, and once as if the chunk starts inside
+/// a string, from just after the first quote. A single pass over the chunks in
+/// order then takes whichever scan passed through the start of the chunk's
+/// first real token, since from there on it found the same tokens a scan of
+/// the whole document would, and has the sanitizer accept them. A chunk where
+/// neither guess was right is scanned again on the calling thread.
+class ParallelScan final
+{
+    // The tokens found in a chunk from one guess at where to start.
+    struct Scan
+    {
+        std::vector<uint32_t> tokens;
+        size_t                exit    = 0;
+        bool                  invalid = false;
+        bool                  done    = false;
+
+        // The first token at or after pos if the scan passed through pos as
+        // the start of a token, otherwise SIZE_MAX.
+        size_t indexOf(size_t pos, size_t base) const noexcept
+        {
+            if (!done) {
+                return SIZE_MAX;
+            }
+            if (pos == exit) {
+                return tokens.size() - (invalid ? 1 : 0);
+            }
+            auto const at = std::lower_bound(tokens.begin(), tokens.end(), pos - base);
+            return ((at != tokens.end()) && (*at == pos - base)) ?
+                       static_cast<size_t>(at - tokens.begin()) :
+                       SIZE_MAX;
+        }
+    };
+
+    struct Chunk
+    {
+        size_t start = 0;
+        size_t end   = 0;
+        Scan   outside;
+        Scan   inside;
+    };
+
+    static void scan(JsonSanitizer &scanner, size_t from, Chunk const &chunk, Scan &scan)
+    {
+        scan.tokens.clear();
+        scan.exit =
+            scanner.scanValidTokens(from, chunk.end, chunk.start, scan.tokens, scan.invalid);
+        scan.done = true;
+    }
+
+    static void scanChunk(JsonSanitizer const &s, Chunk &chunk)
+    {
+        chunk.outside.done = false;
+        chunk.inside.done  = false;
+        try {
+            JsonSanitizer scanner{s._jsonish, s._maximumNestingDepth};
+            scanner._index.reset(s._jsonish);
+            // Start after any run of word characters the chunk starts in the
+            // middle of, since it is the end of a number or keyword.
+            auto from = chunk.start;
+            if ((from > 0) && (scanner._index.nextNonWord(from - 1) > from - 1)) {
+                from = scanner._index.nextNonWord(from);
+            }
+            scan(scanner, from, chunk, chunk.outside);
+            auto const quote = scanner._index.nextUnescaped(chunk.start, &BlockMasks::quote);
+            if (quote < chunk.end) {
+                scan(scanner, quote + 1, chunk, chunk.inside);
+            }
+        } catch (...) {
+            // Left to be scanned again on the calling thread.
+        }
+    }
+
+    static size_t endOfValidPrefix(JsonSanitizer &s, JsonSanitizer::State &state,
+                                   WorkStealingPool &pool, size_t chunkSize)
+    {
+        auto const n      = s._jsonish.length();
+        auto const chunks = (n + chunkSize - 1) / chunkSize;
+        // Scanned a few chunks per thread at a time so that the tokens held
+        // stay small however large the document is.
+        std::vector<Chunk> wave(pool.threads() * 4);
+
+        WorkStealingPool::Job job;
+        job.split = [](size_t begin, size_t end) {
+            return (end - begin > 1) ? begin + (end - begin) / 2 : end;
+        };
+        job.run = [&](size_t begin, size_t end) {
+            for (auto c = begin; c < end; ++c) {
+                scanChunk(s, wave[c]);
+            }
+        };
+
+        auto pos = s._index.nextNonWhitespace(0);
+        while (pos < n) {
+            auto const first = pos / chunkSize;
+            auto const count = std::min(wave.size(), chunks - first);
+            for (size_t c = 0; c < count; ++c) {
+                wave[c].start = (first + c) * chunkSize;
+                wave[c].end   = std::min(wave[c].start + chunkSize, n);
+            }
+            pool.run(job, count);
+
+            for (size_t c = 0; (c < count) && (pos < n); ++c) {
+                auto &chunk = wave[c];
+                if (pos >= chunk.end) {
+                    continue;
+                }
+                auto *found = &chunk.outside;
+                auto  index = found->indexOf(pos, chunk.start);
+                if (index == SIZE_MAX) {
+                    found = &chunk.inside;
+                    index = found->indexOf(pos, chunk.start);
+                }
+                if (index == SIZE_MAX) {
+                    found = &chunk.outside;
+                    scan(s, pos, chunk, *found);
+                    index = 0;
+                }
+                auto const &tokens = found->tokens;
+                auto const  last   = tokens.size() - (found->invalid ? 1 : 0);
+                auto const  reject = s.acceptTokens(tokens.data() + index, tokens.data() + last,
+                                                    chunk.start, state);
+                if (reject != SIZE_MAX) {
+                    return reject;
+                }
+                if (found->invalid) {
+                    return found->exit;
+                }
+                pos = found->exit;
+            }
+        }
+        return n;
+    }
+
+public:
+    static void sanitize(JsonSanitizer &s, OutputSink *sink, SanitizeStats *stats,
+                         BatchOptions const &options)
+    {
+        // Token positions are held as offsets into their chunk.
+        auto const chunkSize = std::min<size_t>(std::max<size_t>(options.grainSize, 1), UINT32_MAX);
+
+        std::unique_ptr<WorkStealingPool> own;
+        if (options.threads != 0) {
+            own = std::make_unique<WorkStealingPool>(options.threads - 1);
+        }
+        auto &pool = own ? *own : WorkStealingPool::shared();
+
+        s._sink  = sink;
+        s._stats = stats;
+        s.startDocument();
+        auto   state = JsonSanitizer::State::START_ARRAY;
+        size_t i     = 0;
+        if ((pool.threads() > 1) && (s._jsonish.length() > chunkSize)) {
+            s._index.reset(s._jsonish);
+            i = endOfValidPrefix(s, state, pool, chunkSize);
+        }
+        s.sanitizeFrom(i, state);
+        s._sink  = nullptr;
+        s._stats = nullptr;
+    }
+};
+
+} // namespace detail
+
+namespace {
+
+// The RFC 7464 record separator.
+constexpr char RECORD_SEPARATOR = '\x1e';
+
+// Records are sanitized this many bytes at a time, so that the results held
+// do not grow with the input.
+constexpr size_t RECORD_WINDOW = 16 * 1024 * 1024;
+
+// Sanitizes each of documents into results, calling failed from inside the
+// catch block for each document that throws. failed may be called from
+// several threads at once.
+void sanitizeEach(std::string_view const *documents, size_t count, BatchOptions const &options,
+                  SanitizeResult *results, std::function<void(size_t)> const &failed)
+{
+    // offsets[i] is the size of the documents before i. Each counts at least
+    // one byte so that runs of empty documents are split too.
+    std::vector<size_t> offsets(count + 1);
+    for (size_t i = 0; i < count; ++i) {
+        offsets[i + 1] = offsets[i] + std::max<size_t>(documents[i].length(), 1);
+    }
+
+    detail::WorkStealingPool::Job job;
+    job.split = [&](size_t begin, size_t end) {
+        if ((end - begin < 2) || (offsets[end] - offsets[begin] <= options.grainSize)) {
+            return end;
+        }
+        // Split at the middle byte rather than the middle document.
+        auto const middle = offsets[begin] + (offsets[end] - offsets[begin]) / 2;
+        auto const at     = std::lower_bound(offsets.begin() + begin + 1,
+                                             offsets.begin() + end - 1, middle);
+        return static_cast<size_t>(at - offsets.begin());
+    };
+    job.run = [&](size_t begin, size_t end) {
+        auto context = SanitizerPool::acquire(options.maximumNestingDepth);
+        for (auto i = begin; i < end; ++i) {
+            try {
+                results[i] = context->sanitizeToResult(documents[i]);
+            } catch (...) {
+                failed(i);
+            }
+        }
+    };
+
+    if (options.threads == 0) {
+        detail::WorkStealingPool::shared().run(job, count);
+    } else {
+        detail::WorkStealingPool pool{options.threads - 1};
+        pool.run(job, count);
+    }
+}
+
+std::string_view trimWhitespace(std::string_view s) noexcept
+{
+    auto const first = s.find_first_not_of(" \t\r\n");
+    if (first == std::string_view::npos) {
+        return {};
+    }
+    return s.substr(first, s.find_last_not_of(" \t\r\n") + 1 - first);
+}
+
+// Sets record to the record at input[pos] and returns where the next starts.
+size_t nextRecord(std::string_view input, size_t pos, RecordFraming framing,
+                  std::string_view &record) noexcept
+{
+    auto const n = input.length();
+    switch (framing) {
+        case RecordFraming::LINES: {
+            auto const end = std::min(input.find('\n', pos), n);
+            record         = trimWhitespace(input.substr(pos, end - pos));
+            return (end < n) ? end + 1 : n;
+        }
+        case RecordFraming::RECORD_SEPARATOR: {
+            auto const start = (input[pos] == RECORD_SEPARATOR) ? pos + 1 : pos;
+            auto const end   = std::min(input.find(RECORD_SEPARATOR, start), n);
+            record           = trimWhitespace(input.substr(start, end - start));
+            return end;
+        }
+        default: {
+            if (n - pos < 4) {
+                record = input.substr(pos);
+                return n;
+            }
+            auto const header = reinterpret_cast<unsigned char const *>(input.data() + pos);
+            auto const length = (size_t{header[0]} << 24) | (size_t{header[1]} << 16) |
+                                (size_t{header[2]} << 8) | size_t{header[3]};
+            record = input.substr(pos + 4, length);
+            return pos + 4 + record.length();
+        }
+    }
+}
+
+void writeRecord(OutputSink &sink, RecordFraming framing, std::string_view json)
+{
+    switch (framing) {
+        case RecordFraming::LINES:
+            sink.write(json);
+            sink.write("\n");
+            break;
+        case RecordFraming::RECORD_SEPARATOR:
+            sink.write(std::string_view{&RECORD_SEPARATOR, 1});
+            sink.write(json);
+            sink.write("\n");
+            break;
+        default: {
+            if (json.length() > UINT32_MAX) {
+                throw std::length_error{"Sanitized record too long for its length prefix"};
+            }
+            char const header[4] = {static_cast<char>(json.length() >> 24),
+                                    static_cast<char>(json.length() >> 16),
+                                    static_cast<char>(json.length() >> 8),
+                                    static_cast<char>(json.length())};
+            sink.write(std::string_view{header, sizeof(header)});
+            sink.write(json);
+        } break;
+    }
+}
+
+} // namespace
+
+std::vector<SanitizeResult> sanitizeBatch(std::string_view const *documents, size_t count,
+                                          BatchOptions const &options)
+{
+    std::vector<SanitizeResult> results(count);
+    std::mutex                  errorMutex;
+    size_t                      errorIndex = SIZE_MAX;
+    std::exception_ptr          error;
+
+    sanitizeEach(documents, count, options, results.data(), [&](size_t i) {
+        std::lock_guard<std::mutex> lock{errorMutex};
+        if (i < errorIndex) {
+            errorIndex = i;
+            error      = std::current_exception();
+        }
+    });
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return results;
+}
+
+void sanitizeRecords(std::string_view input, RecordFraming framing, OutputSink &sink,
+                     BatchOptions const &options)
+{
+    std::vector<std::string_view> records;
+    std::vector<SanitizeResult>   results;
+    // Not vector<bool>, which threads cannot set different elements of at once.
+    std::vector<unsigned char> failed;
+
+    for (size_t pos = 0; pos < input.length();) {
+        records.clear();
+        for (size_t bytes = 0; (pos < input.length()) && (bytes < RECORD_WINDOW);) {
+            std::string_view record;
+            pos = nextRecord(input, pos, framing, record);
+            if (record.empty() && (framing != RecordFraming::LENGTH_PREFIXED)) {
+                continue;
+            }
+            records.push_back(record);
+            bytes += record.length();
+        }
+
+        results.clear();
+        results.resize(records.size());
+        failed.assign(records.size(), 0);
+        sanitizeEach(records.data(), records.size(), options, results.data(),
+                     [&](size_t i) { failed[i] = 1; });
+        for (size_t i = 0; i < records.size(); ++i) {
+            writeRecord(sink, framing, failed[i] ? std::string_view{"null"} : results[i].view());
+        }
+    }
+    sink.flush();
+}
+
+SanitizeResult sanitizeParallel(std::string_view jsonish, BatchOptions const &options)
+{
+    JsonSanitizer s{jsonish, options.maximumNestingDepth};
+    detail::ParallelScan::sanitize(s, nullptr, nullptr, options);
+    return std::move(s).toResult();
+}
+
+SanitizeResult sanitizeParallel(std::string_view jsonish, SanitizeStats &stats,
+                                BatchOptions const &options)
+{
+    JsonSanitizer s{jsonish, options.maximumNestingDepth};
+    detail::ParallelScan::sanitize(s, nullptr, &stats, options);
+    return std::move(s).toResult();
+}
+
+void sanitizeParallel(std::string_view jsonish, OutputSink &sink, BatchOptions const &options)
+{
+    JsonSanitizer s{jsonish, options.maximumNestingDepth};
+    detail::ParallelScan::sanitize(s, &sink, nullptr, options);
+}
+
+} // namespace com::google::json
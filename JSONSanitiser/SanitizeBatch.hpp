@@ -0,0 +1,95 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Sanitizing many documents at once, or one large one, on several threads,
+// and streams of framed records such as NDJSON.
+
+#pragma once
+
+#include "jsonsanitiser_export.h"
+#include "JSONSanitiser.hpp"
+#include "OutputSink.hpp"
+#include "SanitizeResult.hpp"
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace com::google::json {
+
+struct BatchOptions
+{
+    int maximumNestingDepth = JsonSanitizer::DEFAULT_NESTING_DEPTH;
+    /// The number of threads to use, counting the caller. 0 uses a pool that
+    /// is shared by all batches, with a thread for each hardware thread.
+    unsigned threads = 0;
+    /// Documents are handed out in runs of about this many bytes. Bigger runs
+    /// are split so that idle threads can take half. sanitizeParallel scans
+    /// its document in chunks of this size.
+    size_t grainSize = 64 * 1024;
+};
+
+/// Sanitizes each of documents, spread across threads, and returns the
+/// results in the same order. Each thread reuses its own buffers. A result
+/// that is a view of its document needs the document to outlive it. If any
+/// document cannot be sanitized, the exception for the first such document is
+/// rethrown once the others are done.
+JSONSANITISER_EXPORT std::vector<SanitizeResult> sanitizeBatch(std::string_view const *documents,
+                                                               size_t                  count,
+                                                               BatchOptions const &options = {});
+
+inline std::vector<SanitizeResult> sanitizeBatch(std::vector<std::string_view> const &documents,
+                                                 BatchOptions const &options = {})
+{
+    return sanitizeBatch(documents.data(), documents.size(), options);
+}
+
+/// How the records of a stream are delimited.
+enum class RecordFraming
+{
+    /// Newline delimited JSON. Every line feed ends a record, even one inside
+    /// a string, so a record cut in two by a raw line break comes out as two
+    /// records rather than swallowing those after it. Blank lines are dropped.
+    LINES,
+    /// RFC 7464 JSON text sequences: each record follows an ASCII RS and ends
+    /// with a line feed. Blank records are dropped.
+    RECORD_SEPARATOR,
+    /// Each record follows its length as four bytes, most significant first.
+    /// A last record cut short is sanitized from what there is of it.
+    LENGTH_PREFIXED
+};
+
+/// Sanitizes each record of input on its own and writes them to sink with
+/// the same framing and in the same order, spread across threads as
+/// sanitizeBatch does. A record that cannot be sanitized, such as one that is
+/// nested too deeply, is written as null.
+JSONSANITISER_EXPORT void sanitizeRecords(std::string_view input, RecordFraming framing,
+                                          OutputSink &sink, BatchOptions const &options = {});
+
+/// Sanitizes a single large document using several threads, with the same
+/// output as JsonSanitizer::sanitize. The longest prefix that is strict JSON,
+/// which for most documents is all of it, is found by scanning chunks in
+/// parallel. Any repair after that is done on the calling thread.
+JSONSANITISER_EXPORT SanitizeResult sanitizeParallel(std::string_view    jsonish,
+                                                     BatchOptions const &options = {});
+
+/// Like sanitizeParallel, and adds the repairs made to stats.
+JSONSANITISER_EXPORT SanitizeResult sanitizeParallel(std::string_view jsonish, SanitizeStats &stats,
+                                                     BatchOptions const &options = {});
+
+/// Like sanitizeParallel, but writes the output to sink.
+JSONSANITISER_EXPORT void sanitizeParallel(std::string_view jsonish, OutputSink &sink,
+                                           BatchOptions const &options = {});
+
+} // namespace com::google::json
@@ -0,0 +1,151 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "SanitizeDispatch.hpp"
+#include "SanitizerContext.hpp"
+#include "StructuralIndex.hpp"
+
+#include <thread>
+
+namespace com::google::json {
+
+namespace {
+
+void count(InputProfile &profile, unsigned char const *block, uint64_t valid) noexcept
+{
+    detail::BlockMasks masks;
+    detail::classifyBlock(block, masks);
+    profile.sampled += detail::popCount(valid);
+    profile.nonAscii += detail::popCount(masks.nonAscii & valid);
+    profile.quotes += detail::popCount(masks.quote & valid);
+    profile.apostrophes += detail::popCount(masks.apostrophe & valid);
+    profile.backslashes += detail::popCount(masks.backslash & valid);
+}
+
+unsigned int hardwareThreads() noexcept
+{
+    static auto const threads = std::thread::hardware_concurrency();
+    return threads;
+}
+
+template <typename... Stats>
+SanitizeResult sanitizeWith(Engine engine, std::string_view jsonish,
+                            DispatchOptions const &options, Stats &...stats)
+{
+    switch (engine) {
+        case Engine::POOLED: {
+            auto context = SanitizerPool::acquire(options.maximumNestingDepth);
+            return context->sanitizeToResult(jsonish, stats...);
+        }
+        case Engine::PARALLEL:
+            return sanitizeParallel(jsonish, stats..., options);
+        case Engine::SERIAL:
+            break;
+    }
+    return JsonSanitizer::sanitizeToResult(jsonish, stats..., options.maximumNestingDepth);
+}
+
+Engine engineFor(std::string_view jsonish, DispatchOptions const &options) noexcept
+{
+    if (jsonish.length() < options.pooledMaximumBytes) {
+        InputProfile profile;
+        profile.length = jsonish.length();
+        return chooseEngine(profile, options);
+    }
+    return chooseEngine(profileInput(jsonish, options.sampleBlocks), options);
+}
+
+void recordEngine(Engine engine)
+{
+    if (RepairStatistics::enabled()) {
+        SanitizeStats stats;
+        stats.engines[static_cast<size_t>(engine)] = 1;
+        RepairStatistics::record(stats);
+    }
+}
+
+} // namespace
+
+InputProfile profileInput(std::string_view jsonish, size_t sampleBlocks) noexcept
+{
+    InputProfile profile;
+    profile.length   = jsonish.length();
+    auto const first = jsonish.find_first_not_of(" \t\n\r");
+    if (first != std::string_view::npos) {
+        profile.firstByte = jsonish[first];
+    }
+
+    auto const data   = reinterpret_cast<unsigned char const *>(jsonish.data());
+    auto const blocks = jsonish.length() / detail::BLOCK_SIZE;
+    if (blocks < sampleBlocks) {
+        // Short enough to count all of it.
+        for (size_t block = 0; block < blocks; ++block) {
+            count(profile, data + block * detail::BLOCK_SIZE, ~uint64_t{0});
+        }
+        auto const left = jsonish.length() % detail::BLOCK_SIZE;
+        if (left != 0) {
+            unsigned char tail[detail::BLOCK_SIZE] = {};
+            for (size_t i = 0; i < left; ++i) {
+                tail[i] = data[blocks * detail::BLOCK_SIZE + i];
+            }
+            count(profile, tail, (uint64_t{1} << left) - 1);
+        }
+    } else if (sampleBlocks != 0) {
+        // The first and last whole blocks and others evenly spaced between.
+        for (size_t k = 0; k < sampleBlocks; ++k) {
+            auto const block = (sampleBlocks > 1) ? k * (blocks - 1) / (sampleBlocks - 1) : 0;
+            count(profile, data + block * detail::BLOCK_SIZE, ~uint64_t{0});
+        }
+    }
+    return profile;
+}
+
+Engine chooseEngine(InputProfile const &profile, DispatchOptions const &options) noexcept
+{
+    if (profile.length < options.pooledMaximumBytes) {
+        return Engine::POOLED;
+    }
+    auto const threads   = (options.threads != 0) ? options.threads : hardwareThreads();
+    auto const container = (profile.firstByte == '{') || (profile.firstByte == '[');
+    if ((threads < 2) || !container || (profile.apostrophes != 0)) {
+        return Engine::SERIAL;
+    }
+    auto const sampled = static_cast<double>(profile.sampled);
+    if (static_cast<double>(profile.quotes) > options.maximumQuoteFraction * sampled) {
+        return Engine::SERIAL;
+    }
+    auto const costly  = static_cast<double>(profile.nonAscii + profile.backslashes);
+    auto const dense   = costly >= options.denseFraction * sampled;
+    auto const minimum = dense ? options.denseParallelMinimumBytes : options.parallelMinimumBytes;
+    return (profile.length >= minimum) ? Engine::PARALLEL : Engine::SERIAL;
+}
+
+SanitizeResult sanitizeAdaptive(std::string_view jsonish, DispatchOptions const &options)
+{
+    auto const engine = engineFor(jsonish, options);
+    auto       result = sanitizeWith(engine, jsonish, options);
+    recordEngine(engine);
+    return result;
+}
+
+SanitizeResult sanitizeAdaptive(std::string_view jsonish, SanitizeStats &stats,
+                                DispatchOptions const &options)
+{
+    auto const engine = engineFor(jsonish, options);
+    auto       result = sanitizeWith(engine, jsonish, options, stats);
+    stats.engines[static_cast<size_t>(engine)] += 1;
+    recordEngine(engine);
+    return result;
+}
+
+} // namespace com::google::json
@@ -0,0 +1,90 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Choosing how to sanitize a document from a quick look at it: short
+// documents go to a pooled context so that they do not allocate, and long ones
+// that look valid are scanned on several threads.
+
+#pragma once
+
+#include "jsonsanitiser_export.h"
+#include "SanitizeBatch.hpp"
+#include "SanitizeResult.hpp"
+#include "SanitizeStats.hpp"
+
+#include <cstddef>
+#include <string_view>
+
+namespace com::google::json {
+
+/// What a sample of a document looks like.
+struct InputProfile
+{
+    size_t length = 0;
+    /// The first byte that is not whitespace, or '\0' if there is none.
+    char firstByte = '\0';
+    /// How many bytes were sampled, and how many of those were of each kind.
+    size_t sampled     = 0;
+    size_t nonAscii    = 0;
+    size_t quotes      = 0;
+    size_t apostrophes = 0;
+    size_t backslashes = 0;
+};
+
+/// The thresholds sanitizeAdaptive() chooses an engine by. The BatchOptions
+/// are used as they are by Engine::PARALLEL, and the nesting depth by every
+/// engine.
+struct DispatchOptions : BatchOptions
+{
+    /// Documents shorter than this use Engine::POOLED.
+    size_t pooledMaximumBytes = 4 * 1024;
+    /// Documents at least this long that look valid use Engine::PARALLEL, if
+    /// there is more than one thread to run it on.
+    size_t parallelMinimumBytes = 1024 * 1024;
+    /// A non-ASCII character or escape takes longer to check than other
+    /// bytes, so documents with at least this fraction of them go parallel
+    /// from denseParallelMinimumBytes.
+    double denseFraction             = 0.125;
+    size_t denseParallelMinimumBytes = 256 * 1024;
+    /// Tokens are accepted one after another on the calling thread even when
+    /// they are found in parallel. A document with more than this fraction of
+    /// quotes is mostly short strings, so it stays on one thread.
+    double maximumQuoteFraction = 0.3;
+    /// How many 64 byte blocks are sampled, spread evenly over the document.
+    size_t sampleBlocks = 16;
+};
+
+/// Counts the bytes of each kind in up to sampleBlocks blocks of jsonish.
+JSONSANITISER_EXPORT InputProfile profileInput(std::string_view jsonish,
+                                               size_t           sampleBlocks) noexcept;
+
+/// The engine sanitizeAdaptive() uses for a document that looks like profile.
+/// A document that does not start with { or [, or has single quotes, is
+/// probably a JavaScript literal that will need repair early on, so it is
+/// never scanned in parallel.
+JSONSANITISER_EXPORT Engine chooseEngine(InputProfile const   &profile,
+                                         DispatchOptions const &options) noexcept;
+
+/// Sanitizes jsonish with whichever engine suits it. The output is the same
+/// as JsonSanitizer::sanitizeToResult gives. Only documents at least
+/// pooledMaximumBytes long are sampled.
+JSONSANITISER_EXPORT SanitizeResult sanitizeAdaptive(std::string_view       jsonish,
+                                                     DispatchOptions const &options = {});
+
+/// Like sanitizeAdaptive, and adds the repairs made and the engine used to
+/// stats.
+JSONSANITISER_EXPORT SanitizeResult sanitizeAdaptive(std::string_view jsonish, SanitizeStats &stats,
+                                                     DispatchOptions const &options = {});
+
+} // namespace com::google::json
@@ -0,0 +1,134 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The output of the sanitizer, handed over without copying it. Output that
+// needed no changes is a view of the input, short output is kept in the result
+// itself and anything longer is the sanitizer's own buffer moved out, still
+// allocated from whatever memory resource the sanitizer used.
+
+#pragma once
+
+#include "jsonsanitiser_export.h"
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace com::google::json {
+
+template <typename Policy>
+class BasicJsonSanitizer;
+
+class JSONSANITISER_EXPORT SanitizeResult final
+{
+public:
+    /// Output no longer than this is copied into the result so that the
+    /// sanitizer's buffer, which is sized for the input, can be freed.
+    static inline constexpr size_t SMALL_CAPACITY = 32;
+
+private:
+    enum class Storage : unsigned char
+    {
+        INPUT,
+        SMALL,
+        OWNED
+    };
+
+    Storage                          _storage = Storage::INPUT;
+    std::string_view                 _input;
+    std::pmr::string                 _owned;
+    unsigned char                    _smallLength = 0;
+    std::array<char, SMALL_CAPACITY> _small;
+
+    template <typename Policy>
+    friend class BasicJsonSanitizer;
+
+    explicit SanitizeResult(std::string_view input) noexcept
+        : _input{input}
+    {}
+
+    // The buffer is moved in by construction, since moving by assignment
+    // would copy it when the memory resources differ.
+    explicit SanitizeResult(std::pmr::string &&output) noexcept
+        : _owned{(output.length() > SMALL_CAPACITY) ? std::move(output)
+                                                    : std::pmr::string{output.get_allocator()}}
+    {
+        if (!_owned.empty()) {
+            _storage = Storage::OWNED;
+        } else {
+            _storage     = Storage::SMALL;
+            _smallLength = static_cast<unsigned char>(output.length());
+            output.copy(_small.data(), output.length());
+        }
+    }
+
+public:
+    SanitizeResult() noexcept = default;
+
+    std::string_view view() const noexcept
+    {
+        switch (_storage) {
+            case Storage::SMALL:
+                return {_small.data(), _smallLength};
+            case Storage::OWNED:
+                return _owned;
+            default:
+                return _input;
+        }
+    }
+
+    operator std::string_view() const noexcept
+    {
+        return view();
+    }
+
+    char const *data() const noexcept
+    {
+        return view().data();
+    }
+
+    size_t size() const noexcept
+    {
+        return view().size();
+    }
+
+    bool empty() const noexcept
+    {
+        return view().empty();
+    }
+
+    /// Whether the output is the input itself, which then has to outlive the
+    /// result.
+    bool aliasesInput() const noexcept
+    {
+        return _storage == Storage::INPUT;
+    }
+
+    std::string str() const
+    {
+        return std::string{view()};
+    }
+
+    /// The output as a string, moved out of the result when it owns one.
+    std::pmr::string release() &&
+    {
+        return (_storage == Storage::OWNED) ? std::move(_owned)
+                                            : std::pmr::string{view(), _owned.get_allocator()};
+    }
+};
+
+} // namespace com::google::json
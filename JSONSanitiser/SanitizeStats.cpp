@@ -0,0 +1,191 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "SanitizeStats.hpp"
+
+#include <atomic>
+
+namespace com::google::json {
+
+namespace {
+
+std::array<char const *, REPAIR_KINDS> const REPAIR_NAMES = {
+    "comment",
+    "quotes added",
+    "single quotes",
+    "null added",
+    "comma elided",
+    "separator added",
+    "number normalized",
+    "key canonicalized",
+    "embedding escaped",
+    "character escaped",
+    "surrogate escaped",
+    "utf-8 replaced",
+    "escape rewritten",
+    "bracket closed",
+    "elided",
+    "truncated"};
+
+std::array<char const *, ENGINE_KINDS> const ENGINE_NAMES = {"pooled", "serial", "parallel"};
+
+/// The totals for one thread. Only the thread that owns a shard writes to it,
+/// so it adds with a plain load and store; the atomics are for the readers.
+struct Shard
+{
+    std::atomic<uint64_t>                           documents{0};
+    std::atomic<uint64_t>                           inputBytes{0};
+    std::array<std::atomic<uint64_t>, REPAIR_KINDS> repairs{};
+    std::array<std::atomic<int64_t>, REPAIR_KINDS>  bytesAdded{};
+    std::array<std::atomic<uint64_t>, ENGINE_KINDS> engines{};
+    std::atomic<bool>                               inUse{true};
+    Shard                                          *next = nullptr;
+};
+
+std::atomic<bool>    collecting{false};
+std::atomic<Shard *> shards{nullptr};
+
+template <typename T>
+void add(std::atomic<T> &total, T value) noexcept
+{
+    total.store(total.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/// Takes a shard that an exited thread gave up, or adds a new one. Shards are
+/// never freed, so there are only ever as many as the most threads that have
+/// recorded at once, and their totals outlive the threads.
+Shard *claimShard()
+{
+    for (auto *shard = shards.load(std::memory_order_acquire); shard != nullptr;
+         shard       = shard->next) {
+        auto expected = false;
+        if (shard->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return shard;
+        }
+    }
+    auto *const shard = new Shard;
+    shard->next       = shards.load(std::memory_order_relaxed);
+    while (!shards.compare_exchange_weak(shard->next, shard, std::memory_order_release,
+                                         std::memory_order_relaxed)) {
+    }
+    return shard;
+}
+
+struct ShardLease
+{
+    Shard *const shard = claimShard();
+
+    ~ShardLease()
+    {
+        shard->inUse.store(false, std::memory_order_release);
+    }
+};
+
+Shard &threadShard()
+{
+    thread_local ShardLease lease;
+    return *lease.shard;
+}
+
+} // namespace
+
+uint64_t SanitizeStats::outputBytes() const noexcept
+{
+    auto bytes = static_cast<int64_t>(inputBytes);
+    for (auto const added : bytesAdded) {
+        bytes += added;
+    }
+    return static_cast<uint64_t>(bytes);
+}
+
+SanitizeStats &SanitizeStats::operator+=(SanitizeStats const &other) noexcept
+{
+    documents += other.documents;
+    inputBytes += other.inputBytes;
+    for (size_t i = 0; i < REPAIR_KINDS; ++i) {
+        repairs[i] += other.repairs[i];
+        bytesAdded[i] += other.bytesAdded[i];
+    }
+    for (size_t i = 0; i < ENGINE_KINDS; ++i) {
+        engines[i] += other.engines[i];
+    }
+    return *this;
+}
+
+SanitizeStats &SanitizeStats::operator-=(SanitizeStats const &other) noexcept
+{
+    documents -= other.documents;
+    inputBytes -= other.inputBytes;
+    for (size_t i = 0; i < REPAIR_KINDS; ++i) {
+        repairs[i] -= other.repairs[i];
+        bytesAdded[i] -= other.bytesAdded[i];
+    }
+    for (size_t i = 0; i < ENGINE_KINDS; ++i) {
+        engines[i] -= other.engines[i];
+    }
+    return *this;
+}
+
+char const *SanitizeStats::name(Repair repair) noexcept
+{
+    return REPAIR_NAMES[static_cast<size_t>(repair)];
+}
+
+char const *SanitizeStats::name(Engine engine) noexcept
+{
+    return ENGINE_NAMES[static_cast<size_t>(engine)];
+}
+
+void RepairStatistics::setEnabled(bool enabled) noexcept
+{
+    collecting.store(enabled, std::memory_order_relaxed);
+}
+
+bool RepairStatistics::enabled() noexcept
+{
+    return collecting.load(std::memory_order_relaxed);
+}
+
+void RepairStatistics::record(SanitizeStats const &stats)
+{
+    auto &shard = threadShard();
+    add(shard.documents, stats.documents);
+    add(shard.inputBytes, stats.inputBytes);
+    for (size_t i = 0; i < REPAIR_KINDS; ++i) {
+        add(shard.repairs[i], stats.repairs[i]);
+        add(shard.bytesAdded[i], stats.bytesAdded[i]);
+    }
+    for (size_t i = 0; i < ENGINE_KINDS; ++i) {
+        add(shard.engines[i], stats.engines[i]);
+    }
+}
+
+SanitizeStats RepairStatistics::totals() noexcept
+{
+    SanitizeStats totals;
+    for (auto *shard = shards.load(std::memory_order_acquire); shard != nullptr;
+         shard       = shard->next) {
+        totals.documents += shard->documents.load(std::memory_order_relaxed);
+        totals.inputBytes += shard->inputBytes.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < REPAIR_KINDS; ++i) {
+            totals.repairs[i] += shard->repairs[i].load(std::memory_order_relaxed);
+            totals.bytesAdded[i] += shard->bytesAdded[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < ENGINE_KINDS; ++i) {
+            totals.engines[i] += shard->engines[i].load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
+
+} // namespace com::google::json
@@ -0,0 +1,127 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Counts of the repairs the sanitizer makes to a document, and totals of them
+// for the whole process.
+
+#pragma once
+
+#include "jsonsanitiser_export.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace com::google::json {
+
+/// The kinds of change the sanitizer makes to its input.
+enum class Repair : uint8_t
+{
+    COMMENT,           ///< A comment was dropped.
+    QUOTES_ADDED,      ///< An unquoted string or key was quoted or an unclosed string closed.
+    SINGLE_QUOTES,     ///< A single quoted string was given double quotes.
+    NULL_ADDED,        ///< null was supplied for a missing value or an empty document.
+    COMMA_ELIDED,      ///< A trailing or misplaced comma was dropped.
+    SEPARATOR_ADDED,   ///< A missing comma, colon or empty key was supplied.
+    NUMBER_NORMALIZED, ///< A hex, octal, signed or incomplete number was rewritten.
+    KEY_CANONICALIZED, ///< A numeric key was quoted in its canonical form.
+    EMBEDDING_ESCAPED, ///< <!--, <script, </script, --> or ]]> in a string was broken up.
+    CHARACTER_ESCAPED, ///< A control character, quote, U+2028 or U+2029 was escaped.
+    SURROGATE_ESCAPED, ///< A lone surrogate, U+FFFE or U+FFFF was escaped.
+    UTF8_REPLACED,     ///< Malformed UTF-8 was replaced with U+FFFD.
+    ESCAPE_REWRITTEN,  ///< A JavaScript escape such as \x41 or \101 was rewritten or dropped.
+    BRACKET_CLOSED,    ///< An unclosed bracket was closed or a mismatched one corrected.
+    ELIDED,            ///< A character that cannot be part of JSON was dropped.
+    TRUNCATED          ///< Input after the first top level value was dropped.
+};
+
+inline constexpr size_t REPAIR_KINDS = static_cast<size_t>(Repair::TRUNCATED) + 1;
+
+/// The ways sanitizeAdaptive() can sanitize a document.
+enum class Engine : uint8_t
+{
+    POOLED,  ///< A SanitizerContext from the calling thread's pool, for short documents.
+    SERIAL,  ///< A JsonSanitizer of its own, on the calling thread.
+    PARALLEL ///< sanitizeParallel, for long documents that look valid.
+};
+
+inline constexpr size_t ENGINE_KINDS = static_cast<size_t>(Engine::PARALLEL) + 1;
+
+/// The repairs made to a document or, added together, to many.
+struct JSONSANITISER_EXPORT SanitizeStats
+{
+    uint64_t documents  = 0;
+    uint64_t inputBytes = 0;
+    /// How many of each kind of repair were made, indexed by Repair.
+    std::array<uint64_t, REPAIR_KINDS> repairs = {};
+    /// How many bytes each kind of repair added to the output, indexed by
+    /// Repair. Repairs that drop input add a negative number.
+    std::array<int64_t, REPAIR_KINDS> bytesAdded = {};
+    /// How many documents sanitizeAdaptive() gave each engine, indexed by
+    /// Engine.
+    std::array<uint64_t, ENGINE_KINDS> engines = {};
+
+    uint64_t count(Repair repair) const noexcept
+    {
+        return repairs[static_cast<size_t>(repair)];
+    }
+
+    uint64_t count(Engine engine) const noexcept
+    {
+        return engines[static_cast<size_t>(engine)];
+    }
+
+    int64_t added(Repair repair) const noexcept
+    {
+        return bytesAdded[static_cast<size_t>(repair)];
+    }
+
+    void note(Repair repair, int64_t bytes, uint64_t times = 1) noexcept
+    {
+        repairs[static_cast<size_t>(repair)] += times;
+        bytesAdded[static_cast<size_t>(repair)] += bytes;
+    }
+
+    /// The size of the output, which is the input plus what the repairs added.
+    uint64_t outputBytes() const noexcept;
+
+    SanitizeStats &operator+=(SanitizeStats const &other) noexcept;
+    SanitizeStats &operator-=(SanitizeStats const &other) noexcept;
+
+    /// A lower case name for repair, such as "comment".
+    static char const *name(Repair repair) noexcept;
+
+    /// A lower case name for engine, such as "pooled".
+    static char const *name(Engine engine) noexcept;
+};
+
+/// Repair totals for every document sanitized in the process while collection
+/// is on. While it is off it costs a flag check per document. Each thread adds
+/// its documents to a shard of its own, so recording takes no locks and never
+/// writes to memory another thread writes to. Totals only grow; subtract an
+/// earlier snapshot to get the repairs over an interval.
+class JSONSANITISER_EXPORT RepairStatistics final
+{
+public:
+    static void setEnabled(bool enabled) noexcept;
+    static bool enabled() noexcept;
+
+    /// Adds stats to the calling thread's shard.
+    static void record(SanitizeStats const &stats);
+
+    /// The sum of every thread's shard, including threads that have exited.
+    static SanitizeStats totals() noexcept;
+};
+
+} // namespace com::google::json
@@ -0,0 +1,68 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "SanitizeTrace.hpp"
+
+#include "JSONSanitiser.hpp"
+
+#include <algorithm>
+#include <array>
+#include <ostream>
+
+namespace com::google::json {
+
+namespace {
+
+std::array<char const *, 4> const EVENT_NAMES = {"valid prefix", "token", "repair", "complete"};
+
+} // namespace
+
+SanitizeTrace::SanitizeTrace(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    _records.resize(size);
+    _mask = size - 1;
+}
+
+std::vector<TraceRecord> SanitizeTrace::records() const
+{
+    auto const               held = std::min<uint64_t>(_recorded, _records.size());
+    std::vector<TraceRecord> records;
+    records.reserve(held);
+    for (auto i = _recorded - held; i != _recorded; ++i) {
+        records.push_back(_records[i & _mask]);
+    }
+    return records;
+}
+
+void SanitizeTrace::dump(std::ostream &out) const
+{
+    for (auto const &record : records()) {
+        out << "offset=" << record.offset << ", " << EVENT_NAMES[static_cast<size_t>(record.event)];
+        if (record.event == TraceEvent::REPAIR) {
+            out << " " << SanitizeStats::name(record.repair);
+        }
+        if ((record.byte >= 0x20) && (record.byte < 0x7F)) {
+            out << ", ch=" << static_cast<char>(record.byte);
+        } else {
+            out << ", ch=0x" << std::hex << static_cast<unsigned int>(record.byte) << std::dec;
+        }
+        out << ", state="
+            << JsonSanitizer::toString(static_cast<JsonSanitizer::State>(record.state)) << "\n";
+    }
+}
+
+} // namespace com::google::json
@@ -0,0 +1,120 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A record of what the sanitizer did to a document, for finding out why it
+// produced the output it did. Tracing is compiled in only when the library is
+// built with JSONSANITISER_TRACE; otherwise the hooks in the sanitizer are
+// empty and cost nothing.
+
+#pragma once
+
+#include "SanitizeStats.hpp"
+#include "jsonsanitiser_export.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+#if !defined(JSONSANITISER_TRACE)
+#define JSONSANITISER_TRACE 0
+#endif
+
+namespace com::google::json {
+
+/// Whether the sanitizer records into a SanitizeTrace set on it.
+inline constexpr bool TRACING = JSONSANITISER_TRACE != 0;
+
+enum class TraceEvent : uint8_t
+{
+    VALID_PREFIX, ///< The input before offset needed no changes.
+    TOKEN,        ///< The sanitizer reached the token at offset.
+    REPAIR,       ///< The token at offset was repaired.
+    COMPLETE      ///< The end of the input was reached at offset.
+};
+
+/// One event, packed into eight bytes.
+struct TraceRecord
+{
+    uint32_t   offset; ///< The low 32 bits of the offset in the document.
+    uint8_t    byte;   ///< The byte at offset, or 0 at the end of the input.
+    uint8_t    state;  ///< The parser state before the token.
+    TraceEvent event;
+    Repair     repair; ///< What was repaired, for REPAIR events.
+};
+
+/// A ring buffer of the latest events in the documents a sanitizer works on.
+/// Recording an event is a store into the ring, so tracing stays linear in the
+/// input and can be left on. A trace is not thread safe; give each sanitizer
+/// its own.
+class JSONSANITISER_EXPORT SanitizeTrace final
+{
+    std::vector<TraceRecord> _records;
+    size_t                   _mask     = 0;
+    uint64_t                 _recorded = 0;
+    uint64_t                 _base     = 0;
+
+public:
+    /// Keeps the last capacity events, rounded up to a power of two.
+    explicit SanitizeTrace(size_t capacity = 256);
+
+    void record(TraceEvent event, size_t offset, uint8_t byte, uint8_t state,
+                Repair repair = Repair::COMMENT) noexcept
+    {
+        _records[_recorded++ & _mask] = {static_cast<uint32_t>(_base + offset), byte, state,
+                                         event, repair};
+    }
+
+    /// Records a repair to the token of the last event.
+    void recordRepair(Repair repair) noexcept
+    {
+        auto last = (_recorded != 0) ? _records[(_recorded - 1) & _mask] : TraceRecord{};
+        last.event  = TraceEvent::REPAIR;
+        last.repair = repair;
+        _records[_recorded++ & _mask] = last;
+    }
+
+    /// Adds dropped to the offsets of later events, for sanitizers that drop
+    /// input they are done with.
+    void rebase(size_t dropped) noexcept
+    {
+        _base += dropped;
+    }
+
+    /// Offsets of later events start again from zero.
+    void startDocument() noexcept
+    {
+        _base = 0;
+    }
+
+    void clear() noexcept
+    {
+        _recorded = 0;
+        _base     = 0;
+    }
+
+    /// How many events have been recorded, including those overwritten.
+    uint64_t recorded() const noexcept
+    {
+        return _recorded;
+    }
+
+    /// The events still held, oldest first.
+    std::vector<TraceRecord> records() const;
+
+    /// Writes the events still held to out, one per line.
+    void dump(std::ostream &out) const;
+};
+
+} // namespace com::google::json
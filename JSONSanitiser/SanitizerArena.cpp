@@ -0,0 +1,41 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "SanitizerArena.hpp"
+
+namespace com::google::json {
+
+void SanitizerArena::release() noexcept
+{
+    _arena.release();
+    _allocated = 0;
+}
+
+void *SanitizerArena::do_allocate(size_t bytes, size_t alignment)
+{
+    auto *p = _arena.allocate(bytes, alignment);
+    _allocated += bytes;
+    return p;
+}
+
+void SanitizerArena::do_deallocate(void *, size_t, size_t)
+{
+    // Everything is freed together by release().
+}
+
+bool SanitizerArena::do_is_equal(std::pmr::memory_resource const &other) const noexcept
+{
+    return this == &other;
+}
+
+} // namespace com::google::json
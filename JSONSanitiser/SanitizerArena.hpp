@@ -0,0 +1,73 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// A bump allocator for batch jobs that sanitize many documents and then free
+// all of their output together.
+
+#pragma once
+
+#include "jsonsanitiser_export.h"
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace com::google::json {
+
+/// A memory resource that hands out memory by bumping a pointer through large
+/// blocks. Freeing a single allocation does nothing; release() frees
+/// everything at once. Pass it to JsonSanitizer::sanitizeToResult or a
+/// SanitizerContext, and release it once the batch's results are done with.
+/// Like std::pmr::monotonic_buffer_resource, it is not thread safe.
+class JSONSANITISER_EXPORT SanitizerArena final : public std::pmr::memory_resource
+{
+    std::pmr::monotonic_buffer_resource _arena;
+    size_t                              _allocated = 0;
+
+public:
+    /// Enough for many thousands of small documents before another block is
+    /// needed.
+    static inline constexpr size_t DEFAULT_BLOCK_SIZE = 4 * 1024 * 1024;
+
+    explicit SanitizerArena(
+        size_t                     initialBlockSize = DEFAULT_BLOCK_SIZE,
+        std::pmr::memory_resource *upstream         = std::pmr::get_default_resource()) noexcept
+        : _arena{initialBlockSize, upstream}
+    {}
+
+    /// Allocates from buffer until it is full, then from upstream.
+    SanitizerArena(void *buffer, size_t size,
+                   std::pmr::memory_resource *upstream = std::pmr::get_default_resource()) noexcept
+        : _arena{buffer, size, upstream}
+    {}
+
+    SanitizerArena(SanitizerArena const &) = delete;
+    SanitizerArena &operator=(SanitizerArena const &) = delete;
+
+    /// The bytes handed out since the arena was made or last released.
+    size_t allocated() const noexcept
+    {
+        return _allocated;
+    }
+
+    /// Frees everything allocated from the arena. Nothing allocated from it
+    /// may be used afterwards.
+    void release() noexcept;
+
+private:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void  do_deallocate(void *p, size_t bytes, size_t alignment) override;
+    bool  do_is_equal(std::pmr::memory_resource const &other) const noexcept override;
+};
+
+} // namespace com::google::json
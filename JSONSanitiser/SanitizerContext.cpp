@@ -0,0 +1,111 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "SanitizerContext.hpp"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace com::google::json {
+
+namespace {
+
+// The contexts given back on this thread, ready to be taken again.
+std::vector<std::unique_ptr<SanitizerContext>> &pooledContexts()
+{
+    thread_local std::vector<std::unique_ptr<SanitizerContext>> contexts = [] {
+        std::vector<std::unique_ptr<SanitizerContext>> v;
+        v.reserve(SanitizerPool::MAX_POOLED);
+        return v;
+    }();
+    return contexts;
+}
+
+} // namespace
+
+void SanitizerContext::setMaximumNestingDepth(int maximumNestingDepth) noexcept
+{
+    auto const depth = std::min(std::max(1, maximumNestingDepth),
+                                JsonSanitizer::MAXIMUM_NESTING_DEPTH);
+    _sanitizer._maximumNestingDepth = depth;
+}
+
+std::string_view SanitizerContext::sanitize(std::string_view jsonish)
+{
+    _sanitizer._jsonish = jsonish;
+    _sanitizer._sink    = nullptr;
+    _sanitizer.sanitize();
+    return _sanitizer._sanitizedJson.empty() ? jsonish
+                                             : std::string_view{_sanitizer._sanitizedJson};
+}
+
+void SanitizerContext::sanitize(std::string_view jsonish, OutputSink &sink)
+{
+    _sanitizer._jsonish = jsonish;
+    _sanitizer._sink    = &sink;
+    _sanitizer.sanitize();
+    _sanitizer._sink = nullptr;
+}
+
+SanitizeResult SanitizerContext::sanitizeToResult(std::string_view jsonish)
+{
+    _sanitizer._jsonish = jsonish;
+    _sanitizer._sink    = nullptr;
+    _sanitizer.sanitize();
+    return std::move(_sanitizer).toResult();
+}
+
+SanitizeResult SanitizerContext::sanitizeToResult(std::string_view jsonish, SanitizeStats &stats)
+{
+    _sanitizer._stats = &stats;
+    try {
+        auto result       = sanitizeToResult(jsonish);
+        _sanitizer._stats = nullptr;
+        return result;
+    } catch (...) {
+        _sanitizer._stats = nullptr;
+        throw;
+    }
+}
+
+void SanitizerContext::trim(size_t retainedCapacity) noexcept
+{
+    if (_sanitizer._sanitizedJson.capacity() > retainedCapacity) {
+        std::pmr::string{_sanitizer._sanitizedJson.get_allocator()}.swap(_sanitizer._sanitizedJson);
+    }
+}
+
+SanitizerPool::Lease SanitizerPool::acquire(int maximumNestingDepth)
+{
+    auto &contexts = pooledContexts();
+    if (contexts.empty()) {
+        return Lease{std::make_unique<SanitizerContext>(maximumNestingDepth)};
+    }
+    auto context = std::move(contexts.back());
+    contexts.pop_back();
+    context->setMaximumNestingDepth(maximumNestingDepth);
+    return Lease{std::move(context)};
+}
+
+void SanitizerPool::release(std::unique_ptr<SanitizerContext> context) noexcept
+{
+    auto &contexts = pooledContexts();
+    if (context && (contexts.size() < MAX_POOLED)) {
+        context->trim(MAX_RETAINED_CAPACITY);
+        contexts.push_back(std::move(context));
+    }
+}
+
+} // namespace com::google::json
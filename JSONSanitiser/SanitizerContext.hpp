@@ -0,0 +1,138 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Sanitizers that are kept and reused from one document to the next, so that
+// a busy server does not allocate output buffers and bracket stacks for every
+// request.
+
+#pragma once
+
+#include "JSONSanitiser.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <string_view>
+
+namespace com::google::json {
+
+/// Sanitizes one document after another, keeping its output buffer and
+/// bracket stack between them.
+class JSONSANITISER_EXPORT SanitizerContext final
+{
+    JsonSanitizer _sanitizer;
+
+public:
+    explicit SanitizerContext(int  maximumNestingDepth = JsonSanitizer::DEFAULT_NESTING_DEPTH,
+                              bool log                 = false) noexcept
+        : _sanitizer{std::string_view{}, maximumNestingDepth, log}
+    {}
+
+    /// The context's buffers are allocated from resource.
+    SanitizerContext(std::pmr::memory_resource *resource, int maximumNestingDepth,
+                     bool log = false) noexcept
+        : _sanitizer{std::string_view{}, maximumNestingDepth, log, resource}
+    {}
+
+    int getMaximumNestingDepth() const noexcept
+    {
+        return _sanitizer.getMaximumNestingDepth();
+    }
+
+    void setMaximumNestingDepth(int maximumNestingDepth) noexcept;
+
+    /// Later documents are recorded in trace, if it is not null and the
+    /// library is built with JSONSANITISER_TRACE.
+    void setTrace(SanitizeTrace *trace) noexcept
+    {
+        _sanitizer.setTrace(trace);
+    }
+
+    /// Sanitizes jsonish. The result is jsonish itself when it needed no
+    /// changes, otherwise it is held by the context, so it is only valid until
+    /// the context is next used.
+    std::string_view sanitize(std::string_view jsonish);
+
+    /// Sanitizes jsonish into sink.
+    void sanitize(std::string_view jsonish, OutputSink &sink);
+
+    /// Sanitizes jsonish into a result that outlives the context. Short output
+    /// is copied into the result and the buffer kept; longer output takes the
+    /// buffer with it.
+    SanitizeResult sanitizeToResult(std::string_view jsonish);
+
+    /// Like sanitizeToResult, and adds the repairs made to stats.
+    SanitizeResult sanitizeToResult(std::string_view jsonish, SanitizeStats &stats);
+
+    /// Frees the output buffer if a large document has grown it past
+    /// retainedCapacity.
+    void trim(size_t retainedCapacity) noexcept;
+};
+
+/// A pool of SanitizerContexts for each thread. Taking a context and giving
+/// it back needs no locks, and once the pool is warm does not allocate.
+class JSONSANITISER_EXPORT SanitizerPool final
+{
+public:
+    /// The most contexts kept for reuse by each thread.
+    static inline constexpr size_t MAX_POOLED = 8;
+
+    /// Output buffers larger than this are freed rather than kept for reuse.
+    static inline constexpr size_t MAX_RETAINED_CAPACITY = 1024 * 1024;
+
+    /// A context taken from the pool. It goes back to the pool of the thread
+    /// that destroys the lease.
+    class Lease final
+    {
+        std::unique_ptr<SanitizerContext> _context;
+
+    public:
+        explicit Lease(std::unique_ptr<SanitizerContext> context) noexcept
+            : _context{std::move(context)}
+        {}
+
+        Lease(Lease &&) noexcept = default;
+
+        Lease &operator=(Lease &&other) noexcept
+        {
+            if (this != &other) {
+                release(std::move(_context));
+                _context = std::move(other._context);
+            }
+            return *this;
+        }
+
+        ~Lease()
+        {
+            release(std::move(_context));
+        }
+
+        SanitizerContext &operator*() const noexcept
+        {
+            return *_context;
+        }
+
+        SanitizerContext *operator->() const noexcept
+        {
+            return _context.get();
+        }
+    };
+
+    static Lease acquire(int maximumNestingDepth = JsonSanitizer::DEFAULT_NESTING_DEPTH);
+
+private:
+    static void release(std::unique_ptr<SanitizerContext> context) noexcept;
+};
+
+} // namespace com::google::json
@@ -0,0 +1,675 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "StructuralIndex.hpp"
+
+#include <array>
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define JSONSANITISER_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// The AVX2 and AVX-512 kernels are built whatever the compiler is told to
+// target and only used on hosts that have the instructions.
+#if defined(__x86_64__) || defined(_M_X64)
+#define JSONSANITISER_HAVE_AVX 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define JSONSANITISER_TARGET(isa)
+#else
+#define JSONSANITISER_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace com::google::json::detail {
+
+namespace {
+
+enum : uint16_t
+{
+    QUOTE      = 1u << 0,
+    APOSTROPHE = 1u << 1,
+    BACKSLASH  = 1u << 2,
+    BRACKET    = 1u << 3,
+    BRACE      = 1u << 4,
+    COMMA      = 1u << 5,
+    COLON      = 1u << 6,
+    WHITESPACE = 1u << 7,
+    SLASH      = 1u << 8,
+    PAREN      = 1u << 9,
+    ANGLE      = 1u << 10,
+    NON_ASCII  = 1u << 11,
+    CONTROL    = 1u << 12,
+    LINE_BREAK = 1u << 13,
+    WORD       = 1u << 14
+};
+
+constexpr std::array<uint16_t, 256> makeClassTable() noexcept
+{
+    std::array<uint16_t, 256> table = {};
+    for (unsigned int c = 0; c < 256; ++c) {
+        uint16_t bits = 0;
+        if (c < 0x20) {
+            bits |= CONTROL;
+        }
+        if (c >= 0x80) {
+            bits |= NON_ASCII;
+        }
+        if ((('0' <= c) && (c <= '9')) || (('a' <= c) && (c <= 'z')) ||
+            (('A' <= c) && (c <= 'Z')) || (c == '+') || (c == '-') || (c == '.') || (c == '_') ||
+            (c == '$')) {
+            bits |= WORD;
+        }
+        switch (c) {
+            case '"':
+                bits |= QUOTE;
+                break;
+            case '\'':
+                bits |= APOSTROPHE;
+                break;
+            case '\\':
+                bits |= BACKSLASH;
+                break;
+            case '[':
+            case ']':
+                bits |= BRACKET;
+                break;
+            case '{':
+            case '}':
+                bits |= BRACE;
+                break;
+            case ',':
+                bits |= COMMA;
+                break;
+            case ':':
+                bits |= COLON;
+                break;
+            case '\n':
+            case '\r':
+                bits |= WHITESPACE | LINE_BREAK;
+                break;
+            case '\t':
+            case ' ':
+                bits |= WHITESPACE;
+                break;
+            case '/':
+                bits |= SLASH;
+                break;
+            case '(':
+            case ')':
+                bits |= PAREN;
+                break;
+            case '<':
+            case '>':
+                bits |= ANGLE;
+                break;
+            case 0xe2:
+                bits |= LINE_BREAK;
+                break;
+            default:
+                break;
+        }
+        table[c] = bits;
+    }
+    return table;
+}
+
+constexpr std::array<uint16_t, 256> CLASS_TABLE = makeClassTable();
+
+// The non-ASCII bytes of a block that UTF-8 validation looks at, one mask per
+// byte value or range. The lead masks leave out the bytes that cannot start a
+// well-formed character: C0, C1 and F5 to FF.
+struct Utf8Bytes
+{
+    uint64_t continuation; // 80-BF
+    uint64_t lead2;        // C2-DF
+    uint64_t lead3;        // E0-EF
+    uint64_t lead4;        // F0-F4
+    uint64_t e0;
+    uint64_t e2;
+    uint64_t ed;
+    uint64_t ef;
+    uint64_t f0;
+    uint64_t f4;
+    uint64_t x80;
+    uint64_t xbf;
+    uint64_t a0ToBf;
+    uint64_t x90ToBf;
+    uint64_t a8ToA9;
+    uint64_t beToBf;
+};
+
+// BlockMasks::utf8 from the bytes of a block. A lead byte is kept if the
+// bytes after it make a well-formed character that strings keep as it is,
+// and a continuation byte is kept if such a lead byte claims it. The checks
+// on the second and third bytes rule out overlong forms, code points past
+// U+10FFFF, surrogates, U+2028, U+2029, U+FFFE and U+FFFF, just as
+// plainUtf8Length() does for one character. Nothing is carried over from the
+// previous block, so characters cut by the block's edges are reported too.
+uint64_t malformedBytes(Utf8Bytes const &b, uint64_t nonAscii) noexcept
+{
+    // Bit n of next1 is set if byte n + 1 is a continuation byte, and so on.
+    auto const next1 = b.continuation >> 1;
+    auto const next2 = b.continuation >> 2;
+    auto const next3 = b.continuation >> 3;
+    auto const two   = b.lead2 & next1;
+    auto const three = b.lead3 & next1 & next2 & ~(b.e0 & ~(b.a0ToBf >> 1)) &
+                       ~(b.ed & (b.a0ToBf >> 1)) & ~(b.e2 & (b.x80 >> 1) & (b.a8ToA9 >> 2)) &
+                       ~(b.ef & (b.xbf >> 1) & (b.beToBf >> 2));
+    auto const four  = b.lead4 & next1 & next2 & next3 & ~(b.f0 & ~(b.x90ToBf >> 1)) &
+                      ~(b.f4 & (b.x90ToBf >> 1));
+    auto const leads = two | three | four;
+    auto const plain =
+        leads | (b.continuation & ((leads << 1) | ((three | four) << 2) | (four << 3)));
+    return nonAscii & ~plain;
+}
+
+enum : uint16_t
+{
+    CONTINUATION = 1u << 0,
+    LEAD2        = 1u << 1,
+    LEAD3        = 1u << 2,
+    LEAD4        = 1u << 3,
+    E0           = 1u << 4,
+    E2           = 1u << 5,
+    ED           = 1u << 6,
+    EF           = 1u << 7,
+    F0           = 1u << 8,
+    F4           = 1u << 9,
+    X80          = 1u << 10,
+    XBF          = 1u << 11,
+    A0_TO_BF     = 1u << 12,
+    X90_TO_BF    = 1u << 13,
+    A8_TO_A9     = 1u << 14,
+    BE_TO_BF     = 1u << 15
+};
+
+constexpr std::array<uint16_t, 256> makeUtf8Table() noexcept
+{
+    std::array<uint16_t, 256> table = {};
+    for (unsigned int c = 0x80; c < 256; ++c) {
+        uint16_t bits = 0;
+        bits |= (c <= 0xbf) ? CONTINUATION : 0;
+        bits |= ((0xc2 <= c) && (c <= 0xdf)) ? LEAD2 : 0;
+        bits |= ((0xe0 <= c) && (c <= 0xef)) ? LEAD3 : 0;
+        bits |= ((0xf0 <= c) && (c <= 0xf4)) ? LEAD4 : 0;
+        bits |= (c == 0xe0) ? E0 : 0;
+        bits |= (c == 0xe2) ? E2 : 0;
+        bits |= (c == 0xed) ? ED : 0;
+        bits |= (c == 0xef) ? EF : 0;
+        bits |= (c == 0xf0) ? F0 : 0;
+        bits |= (c == 0xf4) ? F4 : 0;
+        bits |= (c == 0x80) ? X80 : 0;
+        bits |= (c == 0xbf) ? XBF : 0;
+        bits |= ((0xa0 <= c) && (c <= 0xbf)) ? A0_TO_BF : 0;
+        bits |= ((0x90 <= c) && (c <= 0xbf)) ? X90_TO_BF : 0;
+        bits |= ((c == 0xa8) || (c == 0xa9)) ? A8_TO_A9 : 0;
+        bits |= ((c == 0xbe) || (c == 0xbf)) ? BE_TO_BF : 0;
+        table[c] = bits;
+    }
+    return table;
+}
+
+constexpr std::array<uint16_t, 256> UTF8_TABLE = makeUtf8Table();
+
+void classifyScalar(unsigned char const *block, BlockMasks &masks) noexcept
+{
+    masks = {};
+    for (unsigned int i = 0; i < BLOCK_SIZE; ++i) {
+        auto const bits = CLASS_TABLE[block[i]];
+        auto const bit  = uint64_t{1} << i;
+        masks.quote |= (bits & QUOTE) ? bit : 0;
+        masks.apostrophe |= (bits & APOSTROPHE) ? bit : 0;
+        masks.backslash |= (bits & BACKSLASH) ? bit : 0;
+        masks.bracket |= (bits & BRACKET) ? bit : 0;
+        masks.brace |= (bits & BRACE) ? bit : 0;
+        masks.comma |= (bits & COMMA) ? bit : 0;
+        masks.colon |= (bits & COLON) ? bit : 0;
+        masks.whitespace |= (bits & WHITESPACE) ? bit : 0;
+        masks.slash |= (bits & SLASH) ? bit : 0;
+        masks.paren |= (bits & PAREN) ? bit : 0;
+        masks.angle |= (bits & ANGLE) ? bit : 0;
+        masks.nonAscii |= (bits & NON_ASCII) ? bit : 0;
+        masks.control |= (bits & CONTROL) ? bit : 0;
+        masks.lineBreak |= (bits & LINE_BREAK) ? bit : 0;
+        masks.word |= (bits & WORD) ? bit : 0;
+    }
+    if (masks.nonAscii == 0) {
+        return;
+    }
+    Utf8Bytes bytes = {};
+    for (unsigned int i = 0; i < BLOCK_SIZE; ++i) {
+        auto const bits = UTF8_TABLE[block[i]];
+        auto const bit  = uint64_t{1} << i;
+        bytes.continuation |= (bits & CONTINUATION) ? bit : 0;
+        bytes.lead2 |= (bits & LEAD2) ? bit : 0;
+        bytes.lead3 |= (bits & LEAD3) ? bit : 0;
+        bytes.lead4 |= (bits & LEAD4) ? bit : 0;
+        bytes.e0 |= (bits & E0) ? bit : 0;
+        bytes.e2 |= (bits & E2) ? bit : 0;
+        bytes.ed |= (bits & ED) ? bit : 0;
+        bytes.ef |= (bits & EF) ? bit : 0;
+        bytes.f0 |= (bits & F0) ? bit : 0;
+        bytes.f4 |= (bits & F4) ? bit : 0;
+        bytes.x80 |= (bits & X80) ? bit : 0;
+        bytes.xbf |= (bits & XBF) ? bit : 0;
+        bytes.a0ToBf |= (bits & A0_TO_BF) ? bit : 0;
+        bytes.x90ToBf |= (bits & X90_TO_BF) ? bit : 0;
+        bytes.a8ToA9 |= (bits & A8_TO_A9) ? bit : 0;
+        bytes.beToBf |= (bits & BE_TO_BF) ? bit : 0;
+    }
+    masks.utf8 = malformedBytes(bytes, masks.nonAscii);
+}
+
+#if defined(JSONSANITISER_HAVE_SSE2)
+
+inline uint64_t movemask(__m128i v) noexcept
+{
+    return static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(v)) & 0xffffu);
+}
+
+inline __m128i eq(__m128i v, char c) noexcept
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+// Unsigned v <= limit for every byte.
+inline __m128i le(__m128i v, unsigned char limit) noexcept
+{
+    auto const l = _mm_set1_epi8(static_cast<char>(limit));
+    return _mm_cmpeq_epi8(_mm_min_epu8(v, l), v);
+}
+
+// Unsigned lo <= v <= hi for every byte.
+inline __m128i inRange(__m128i v, unsigned char lo, unsigned char hi) noexcept
+{
+    return le(_mm_sub_epi8(v, _mm_set1_epi8(static_cast<char>(lo))),
+              static_cast<unsigned char>(hi - lo));
+}
+
+inline __m128i eq(__m128i v, unsigned char c) noexcept
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(static_cast<char>(c)));
+}
+
+Utf8Bytes utf8BytesSse2(unsigned char const *block) noexcept
+{
+    Utf8Bytes bytes = {};
+    for (unsigned int i = 0; i < BLOCK_SIZE; i += 16) {
+        auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(block + i));
+
+        bytes.continuation |= movemask(inRange(v, 0x80, 0xbf)) << i;
+        bytes.lead2 |= movemask(inRange(v, 0xc2, 0xdf)) << i;
+        bytes.lead3 |= movemask(inRange(v, 0xe0, 0xef)) << i;
+        bytes.lead4 |= movemask(inRange(v, 0xf0, 0xf4)) << i;
+        bytes.e0 |= movemask(eq(v, uint8_t{0xe0})) << i;
+        bytes.e2 |= movemask(eq(v, uint8_t{0xe2})) << i;
+        bytes.ed |= movemask(eq(v, uint8_t{0xed})) << i;
+        bytes.ef |= movemask(eq(v, uint8_t{0xef})) << i;
+        bytes.f0 |= movemask(eq(v, uint8_t{0xf0})) << i;
+        bytes.f4 |= movemask(eq(v, uint8_t{0xf4})) << i;
+        bytes.x80 |= movemask(eq(v, uint8_t{0x80})) << i;
+        bytes.xbf |= movemask(eq(v, uint8_t{0xbf})) << i;
+        bytes.a0ToBf |= movemask(inRange(v, 0xa0, 0xbf)) << i;
+        bytes.x90ToBf |= movemask(inRange(v, 0x90, 0xbf)) << i;
+        bytes.a8ToA9 |= movemask(inRange(v, 0xa8, 0xa9)) << i;
+        bytes.beToBf |= movemask(inRange(v, 0xbe, 0xbf)) << i;
+    }
+    return bytes;
+}
+
+void classifySse2(unsigned char const *block, BlockMasks &masks) noexcept
+{
+    masks = {};
+    for (unsigned int i = 0; i < BLOCK_SIZE; i += 16) {
+        auto const v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(block + i));
+
+        auto const cr         = eq(v, '\r');
+        auto const lf         = eq(v, '\n');
+        auto const lowerAlpha = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        auto const word       = _mm_or_si128(
+            _mm_or_si128(inRange(v, '0', '9'), inRange(lowerAlpha, 'a', 'z')),
+            _mm_or_si128(_mm_or_si128(eq(v, '+'), eq(v, '-')),
+                         _mm_or_si128(_mm_or_si128(eq(v, '.'), eq(v, '_')), eq(v, '$'))));
+
+        masks.quote |= movemask(eq(v, '"')) << i;
+        masks.apostrophe |= movemask(eq(v, '\'')) << i;
+        masks.backslash |= movemask(eq(v, '\\')) << i;
+        masks.bracket |= movemask(_mm_or_si128(eq(v, '['), eq(v, ']'))) << i;
+        masks.brace |= movemask(_mm_or_si128(eq(v, '{'), eq(v, '}'))) << i;
+        masks.comma |= movemask(eq(v, ',')) << i;
+        masks.colon |= movemask(eq(v, ':')) << i;
+        masks.whitespace |=
+            movemask(_mm_or_si128(_mm_or_si128(eq(v, ' '), eq(v, '\t')), _mm_or_si128(cr, lf)))
+            << i;
+        masks.slash |= movemask(eq(v, '/')) << i;
+        masks.paren |= movemask(_mm_or_si128(eq(v, '('), eq(v, ')'))) << i;
+        masks.angle |= movemask(_mm_or_si128(eq(v, '<'), eq(v, '>'))) << i;
+        masks.nonAscii |= movemask(v) << i;
+        masks.control |= movemask(le(v, 0x1f)) << i;
+        masks.lineBreak |=
+            movemask(_mm_or_si128(_mm_or_si128(cr, lf), eq(v, static_cast<char>(0xe2)))) << i;
+        masks.word |= movemask(word) << i;
+    }
+    if (masks.nonAscii != 0) {
+        masks.utf8 = malformedBytes(utf8BytesSse2(block), masks.nonAscii);
+    }
+}
+
+#endif
+
+#if defined(JSONSANITISER_HAVE_AVX)
+
+// The AVX2 kernel is the SSE2 one on 32 byte halves of the block.
+
+JSONSANITISER_TARGET("avx2") inline uint64_t movemask(__m256i v) noexcept
+{
+    return static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(v)));
+}
+
+JSONSANITISER_TARGET("avx2") inline __m256i eq(__m256i v, char c) noexcept
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+JSONSANITISER_TARGET("avx2") inline __m256i le(__m256i v, unsigned char limit) noexcept
+{
+    auto const l = _mm256_set1_epi8(static_cast<char>(limit));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(v, l), v);
+}
+
+JSONSANITISER_TARGET("avx2")
+inline __m256i inRange(__m256i v, unsigned char lo, unsigned char hi) noexcept
+{
+    return le(_mm256_sub_epi8(v, _mm256_set1_epi8(static_cast<char>(lo))),
+              static_cast<unsigned char>(hi - lo));
+}
+
+JSONSANITISER_TARGET("avx2") inline __m256i eq(__m256i v, unsigned char c) noexcept
+{
+    return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(static_cast<char>(c)));
+}
+
+JSONSANITISER_TARGET("avx2") Utf8Bytes utf8BytesAvx2(unsigned char const *block) noexcept
+{
+    Utf8Bytes bytes = {};
+    for (unsigned int i = 0; i < BLOCK_SIZE; i += 32) {
+        auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(block + i));
+
+        bytes.continuation |= movemask(inRange(v, 0x80, 0xbf)) << i;
+        bytes.lead2 |= movemask(inRange(v, 0xc2, 0xdf)) << i;
+        bytes.lead3 |= movemask(inRange(v, 0xe0, 0xef)) << i;
+        bytes.lead4 |= movemask(inRange(v, 0xf0, 0xf4)) << i;
+        bytes.e0 |= movemask(eq(v, uint8_t{0xe0})) << i;
+        bytes.e2 |= movemask(eq(v, uint8_t{0xe2})) << i;
+        bytes.ed |= movemask(eq(v, uint8_t{0xed})) << i;
+        bytes.ef |= movemask(eq(v, uint8_t{0xef})) << i;
+        bytes.f0 |= movemask(eq(v, uint8_t{0xf0})) << i;
+        bytes.f4 |= movemask(eq(v, uint8_t{0xf4})) << i;
+        bytes.x80 |= movemask(eq(v, uint8_t{0x80})) << i;
+        bytes.xbf |= movemask(eq(v, uint8_t{0xbf})) << i;
+        bytes.a0ToBf |= movemask(inRange(v, 0xa0, 0xbf)) << i;
+        bytes.x90ToBf |= movemask(inRange(v, 0x90, 0xbf)) << i;
+        bytes.a8ToA9 |= movemask(inRange(v, 0xa8, 0xa9)) << i;
+        bytes.beToBf |= movemask(inRange(v, 0xbe, 0xbf)) << i;
+    }
+    return bytes;
+}
+
+JSONSANITISER_TARGET("avx2")
+void classifyAvx2(unsigned char const *block, BlockMasks &masks) noexcept
+{
+    masks = {};
+    for (unsigned int i = 0; i < BLOCK_SIZE; i += 32) {
+        auto const v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(block + i));
+
+        auto const cr         = eq(v, '\r');
+        auto const lf         = eq(v, '\n');
+        auto const lowerAlpha = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        auto const word       = _mm256_or_si256(
+            _mm256_or_si256(inRange(v, '0', '9'), inRange(lowerAlpha, 'a', 'z')),
+            _mm256_or_si256(_mm256_or_si256(eq(v, '+'), eq(v, '-')),
+                            _mm256_or_si256(_mm256_or_si256(eq(v, '.'), eq(v, '_')), eq(v, '$'))));
+
+        masks.quote |= movemask(eq(v, '"')) << i;
+        masks.apostrophe |= movemask(eq(v, '\'')) << i;
+        masks.backslash |= movemask(eq(v, '\\')) << i;
+        masks.bracket |= movemask(_mm256_or_si256(eq(v, '['), eq(v, ']'))) << i;
+        masks.brace |= movemask(_mm256_or_si256(eq(v, '{'), eq(v, '}'))) << i;
+        masks.comma |= movemask(eq(v, ',')) << i;
+        masks.colon |= movemask(eq(v, ':')) << i;
+        masks.whitespace |= movemask(_mm256_or_si256(_mm256_or_si256(eq(v, ' '), eq(v, '\t')),
+                                                     _mm256_or_si256(cr, lf)))
+                            << i;
+        masks.slash |= movemask(eq(v, '/')) << i;
+        masks.paren |= movemask(_mm256_or_si256(eq(v, '('), eq(v, ')'))) << i;
+        masks.angle |= movemask(_mm256_or_si256(eq(v, '<'), eq(v, '>'))) << i;
+        masks.nonAscii |= movemask(v) << i;
+        masks.control |= movemask(le(v, 0x1f)) << i;
+        masks.lineBreak |=
+            movemask(_mm256_or_si256(_mm256_or_si256(cr, lf), eq(v, static_cast<char>(0xe2))))
+            << i;
+        masks.word |= movemask(word) << i;
+    }
+    if (masks.nonAscii != 0) {
+        masks.utf8 = malformedBytes(utf8BytesAvx2(block), masks.nonAscii);
+    }
+}
+
+// AVX-512BW compares straight into a 64 bit mask, so a block is one register.
+
+JSONSANITISER_TARGET("avx512f,avx512bw") inline uint64_t eq(__m512i v, char c) noexcept
+{
+    return _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(c));
+}
+
+JSONSANITISER_TARGET("avx512f,avx512bw")
+inline uint64_t inRange(__m512i v, unsigned char lo, unsigned char hi) noexcept
+{
+    return _mm512_cmple_epu8_mask(_mm512_sub_epi8(v, _mm512_set1_epi8(static_cast<char>(lo))),
+                                  _mm512_set1_epi8(static_cast<char>(hi - lo)));
+}
+
+JSONSANITISER_TARGET("avx512f,avx512bw")
+inline uint64_t eq(__m512i v, unsigned char c) noexcept
+{
+    return _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(static_cast<char>(c)));
+}
+
+JSONSANITISER_TARGET("avx512f,avx512bw")
+void classifyAvx512(unsigned char const *block, BlockMasks &masks) noexcept
+{
+    auto const v          = _mm512_loadu_si512(block);
+    auto const lowerAlpha = _mm512_or_si512(v, _mm512_set1_epi8(0x20));
+    auto const newline    = eq(v, '\r') | eq(v, '\n');
+
+    masks.quote      = eq(v, '"');
+    masks.apostrophe = eq(v, '\'');
+    masks.backslash  = eq(v, '\\');
+    masks.bracket    = eq(v, '[') | eq(v, ']');
+    masks.brace      = eq(v, '{') | eq(v, '}');
+    masks.comma      = eq(v, ',');
+    masks.colon      = eq(v, ':');
+    masks.whitespace = eq(v, ' ') | eq(v, '\t') | newline;
+    masks.slash      = eq(v, '/');
+    masks.paren      = eq(v, '(') | eq(v, ')');
+    masks.angle      = eq(v, '<') | eq(v, '>');
+    masks.nonAscii   = _mm512_movepi8_mask(v);
+    masks.control    = _mm512_cmple_epu8_mask(v, _mm512_set1_epi8(0x1f));
+    masks.lineBreak  = newline | eq(v, static_cast<char>(0xe2));
+    masks.word       = inRange(v, '0', '9') | inRange(lowerAlpha, 'a', 'z') | eq(v, '+') |
+                       eq(v, '-') | eq(v, '.') | eq(v, '_') | eq(v, '$');
+    masks.utf8       = 0;
+    if (masks.nonAscii != 0) {
+        Utf8Bytes bytes;
+        bytes.continuation = inRange(v, 0x80, 0xbf);
+        bytes.lead2        = inRange(v, 0xc2, 0xdf);
+        bytes.lead3        = inRange(v, 0xe0, 0xef);
+        bytes.lead4        = inRange(v, 0xf0, 0xf4);
+        bytes.e0           = eq(v, uint8_t{0xe0});
+        bytes.e2           = eq(v, uint8_t{0xe2});
+        bytes.ed           = eq(v, uint8_t{0xed});
+        bytes.ef           = eq(v, uint8_t{0xef});
+        bytes.f0           = eq(v, uint8_t{0xf0});
+        bytes.f4           = eq(v, uint8_t{0xf4});
+        bytes.x80          = eq(v, uint8_t{0x80});
+        bytes.xbf          = eq(v, uint8_t{0xbf});
+        bytes.a0ToBf       = inRange(v, 0xa0, 0xbf);
+        bytes.x90ToBf      = inRange(v, 0x90, 0xbf);
+        bytes.a8ToA9       = inRange(v, 0xa8, 0xa9);
+        bytes.beToBf       = inRange(v, 0xbe, 0xbf);
+        masks.utf8         = malformedBytes(bytes, masks.nonAscii);
+    }
+}
+
+#if defined(_MSC_VER) && !defined(__clang__)
+
+// Bits of the XCR0 register that say the OS saves the YMM and ZMM registers.
+constexpr uint64_t XCR0_YMM = 0x06;
+constexpr uint64_t XCR0_ZMM = 0xe6;
+
+uint64_t savedRegisters() noexcept
+{
+    int info[4];
+    __cpuid(info, 1);
+    // OSXSAVE
+    return ((info[2] & (1 << 27)) != 0) ? _xgetbv(0) : 0;
+}
+
+bool hasAvx2() noexcept
+{
+    int info[4];
+    __cpuidex(info, 7, 0);
+    return ((info[1] & (1 << 5)) != 0) && ((savedRegisters() & XCR0_YMM) == XCR0_YMM);
+}
+
+bool hasAvx512() noexcept
+{
+    int info[4];
+    __cpuidex(info, 7, 0);
+    // AVX512F and AVX512BW
+    return ((info[1] & (1 << 16)) != 0) && ((info[1] & (1 << 30)) != 0) &&
+           ((savedRegisters() & XCR0_ZMM) == XCR0_ZMM);
+}
+
+#else
+
+// These also check that the OS saves the wider registers.
+
+bool hasAvx2() noexcept
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+bool hasAvx512() noexcept
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+}
+
+#endif
+
+#endif
+
+bool always() noexcept
+{
+    return true;
+}
+
+struct Implementation
+{
+    BlockClassifier classifier;
+    bool (*supported)() noexcept;
+};
+
+// Narrowest first.
+constexpr Implementation IMPLEMENTATIONS[] = {
+    {{"scalar", classifyScalar}, always},
+#if defined(JSONSANITISER_HAVE_SSE2)
+    {{"sse2", classifySse2}, always},
+#endif
+#if defined(JSONSANITISER_HAVE_AVX)
+    {{"avx2", classifyAvx2}, hasAvx2},
+    {{"avx512bw", classifyAvx512}, hasAvx512},
+#endif
+};
+
+using Classify = void (*)(unsigned char const *block, BlockMasks &masks) noexcept;
+
+Classify widest() noexcept
+{
+    Classify classify = nullptr;
+    for (auto const &implementation : IMPLEMENTATIONS) {
+        if (implementation.supported()) {
+            classify = implementation.classifier.classify;
+        }
+    }
+    return classify;
+}
+
+void classifyFirst(unsigned char const *block, BlockMasks &masks) noexcept;
+
+// Starts out as classifyFirst(), which replaces itself with the widest
+// implementation the host can run. Threads that race to do so all store the
+// same thing.
+std::atomic<Classify> chosen{classifyFirst};
+
+void classifyFirst(unsigned char const *block, BlockMasks &masks) noexcept
+{
+    auto const classify = widest();
+    chosen.store(classify, std::memory_order_relaxed);
+    classify(block, masks);
+}
+
+} // namespace
+
+void classifyBlock(unsigned char const *block, BlockMasks &masks) noexcept
+{
+    chosen.load(std::memory_order_relaxed)(block, masks);
+}
+
+std::vector<BlockClassifier> blockClassifiers()
+{
+    std::vector<BlockClassifier> classifiers;
+    for (auto const &implementation : IMPLEMENTATIONS) {
+        if (implementation.supported()) {
+            classifiers.push_back(implementation.classifier);
+        }
+    }
+    return classifiers;
+}
+
+BlockClassifier blockClassifier() noexcept
+{
+    auto classify = chosen.load(std::memory_order_relaxed);
+    if (classify == classifyFirst) {
+        classify = widest();
+        chosen.store(classify, std::memory_order_relaxed);
+    }
+    for (auto const &implementation : IMPLEMENTATIONS) {
+        if (implementation.classifier.classify == classify) {
+            return implementation.classifier;
+        }
+    }
+    return {"unknown", classify};
+}
+
+void setBlockClassifier(BlockClassifier const &classifier) noexcept
+{
+    chosen.store(classifier.classify, std::memory_order_relaxed);
+}
+
+} // namespace com::google::json::detail
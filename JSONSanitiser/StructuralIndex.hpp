@@ -0,0 +1,264 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// First stage of the sanitizer. The input is classified 64 bytes at a time
+// into one bitmask per character class so that the state machine in
+// JsonSanitizer::sanitize() can jump from one interesting byte to the next
+// instead of decoding every character.
+
+#pragma once
+
+#include "jsonsanitiser_export.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace com::google::json::detail {
+
+/// One bit per byte of a 64 byte block. Bit n refers to byte n of the block.
+struct BlockMasks
+{
+    uint64_t quote;      ///< "
+    uint64_t apostrophe; ///< '
+    uint64_t backslash;  ///< \ (backslash)
+    uint64_t bracket;    ///< [ and ]
+    uint64_t brace;      ///< { and }
+    uint64_t comma;      ///< ,
+    uint64_t colon;      ///< :
+    uint64_t whitespace; ///< \t, \n, \r and space
+    uint64_t slash;      ///< /
+    uint64_t paren;      ///< ( and )
+    uint64_t angle;      ///< < and >
+    uint64_t nonAscii;   ///< Any byte >= 0x80
+    uint64_t control;    ///< Any byte < 0x20
+    uint64_t lineBreak;  ///< \n, \r and 0xE2 (the lead byte of U+2028 and U+2029)
+    uint64_t word;       ///< [0-9A-Za-z+\-._$], the characters of numbers, keywords and names
+    /// Non-ASCII bytes that are not part of a character a string keeps as it
+    /// is: malformed UTF-8, surrogates, U+2028, U+2029, U+FFFE, U+FFFF, and
+    /// any character cut by the edge of the block.
+    uint64_t utf8;
+};
+
+inline constexpr size_t BLOCK_SIZE = 64;
+
+/// Classifies exactly BLOCK_SIZE bytes starting at block.
+JSONSANITISER_EXPORT void classifyBlock(unsigned char const *block, BlockMasks &masks) noexcept;
+
+/// An implementation of classifyBlock() for one instruction set.
+struct BlockClassifier
+{
+    char const *name;
+    void (*classify)(unsigned char const *block, BlockMasks &masks) noexcept;
+};
+
+/// The implementations of classifyBlock() that this build has and the host
+/// can run, the plain C++ one first and the widest last.
+JSONSANITISER_EXPORT std::vector<BlockClassifier> blockClassifiers();
+
+/// The implementation classifyBlock() uses. Unless setBlockClassifier() says
+/// otherwise that is the widest the host can run, chosen on first use.
+JSONSANITISER_EXPORT BlockClassifier blockClassifier() noexcept;
+
+/// Makes classifyBlock() use classifier, which should be one of
+/// blockClassifiers(). For testing, and for ruling one out on a host.
+JSONSANITISER_EXPORT void setBlockClassifier(BlockClassifier const &classifier) noexcept;
+
+inline unsigned int trailingZeroes(uint64_t bits) noexcept
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<unsigned int>(index);
+#else
+    return static_cast<unsigned int>(__builtin_ctzll(bits));
+#endif
+}
+
+inline unsigned int popCount(uint64_t bits) noexcept
+{
+#if defined(_MSC_VER)
+    return static_cast<unsigned int>(__popcnt64(bits));
+#else
+    return static_cast<unsigned int>(__builtin_popcountll(bits));
+#endif
+}
+
+/// The bytes of a block that are escaped by a preceding backslash, given the
+/// backslashes in the block. carry says whether the first byte of the block is
+/// escaped by the previous block and is updated for the next one. A backslash
+/// run of odd length escapes the byte after it.
+inline uint64_t escapedBytes(uint64_t backslash, uint64_t &carry) noexcept
+{
+    constexpr uint64_t EVEN_BITS = 0x5555555555555555ULL;
+
+    backslash &= ~carry;
+    auto const followsEscape = (backslash << 1) | carry;
+    // Adding the starts of the runs that begin on odd bits to the runs
+    // themselves carries each such run out past its end, which leaves a bit
+    // set just after every run that began on an even bit.
+    auto const oddStarts = backslash & ~EVEN_BITS & ~followsEscape;
+    auto const evenEnds  = oddStarts + backslash;
+    carry                = (evenEnds < oddStarts) ? 1u : 0u;
+    return (EVEN_BITS ^ (evenEnds << 1)) & followsEscape;
+}
+
+class StructuralIndex final
+{
+    std::string_view _input;
+    size_t           _block = SIZE_MAX;
+    uint64_t         _valid = 0;
+    BlockMasks       _masks = {};
+
+    BlockMasks const &masksFor(size_t block) noexcept
+    {
+        if (block != _block) {
+            auto const start = block * BLOCK_SIZE;
+            auto const left  = _input.length() - start;
+            auto const data  = reinterpret_cast<unsigned char const *>(_input.data()) + start;
+            if (left >= BLOCK_SIZE) {
+                classifyBlock(data, _masks);
+                _valid = ~uint64_t{0};
+            } else {
+                // Pad the tail out to a whole block. The padding is masked off
+                // by _valid so its value does not matter.
+                unsigned char tail[BLOCK_SIZE] = {};
+                for (size_t i = 0; i < left; ++i) {
+                    tail[i] = data[i];
+                }
+                classifyBlock(tail, _masks);
+                _valid = (uint64_t{1} << left) - 1;
+            }
+            _block = block;
+        }
+        return _masks;
+    }
+
+public:
+    void reset(std::string_view input) noexcept
+    {
+        _input = input;
+        _block = SIZE_MAX;
+    }
+
+    /// The position of the first byte in [pos, limit) whose bit is set in
+    /// select(masks), or limit if there is none.
+    template <typename Select>
+    size_t find(size_t pos, size_t limit, Select select) noexcept
+    {
+        while (pos < limit) {
+            auto const block = pos / BLOCK_SIZE;
+            auto const bits  = select(masksFor(block)) & _valid &
+                              (~uint64_t{0} << (pos % BLOCK_SIZE));
+            if (bits != 0) {
+                auto const found = block * BLOCK_SIZE + trailingZeroes(bits);
+                return (found < limit) ? found : limit;
+            }
+            pos = (block + 1) * BLOCK_SIZE;
+        }
+        return limit;
+    }
+
+    template <typename Select>
+    size_t find(size_t pos, Select select) noexcept
+    {
+        return find(pos, _input.length(), select);
+    }
+
+    size_t nextNonWhitespace(size_t pos) noexcept
+    {
+        // Tokens are usually adjacent in compact JSON so check the first byte
+        // before going to the masks.
+        if (pos < _input.length()) {
+            switch (_input[pos]) {
+                case '\t':
+                case '\n':
+                case '\r':
+                case ' ':
+                    break;
+                default:
+                    return pos;
+            }
+        }
+        return find(pos, [](BlockMasks const &m) { return ~m.whitespace; });
+    }
+
+    /// The end of a run of ASCII number, keyword or name characters.
+    size_t nextNonWord(size_t pos) noexcept
+    {
+        return find(pos, [](BlockMasks const &m) { return ~m.word; });
+    }
+
+    /// The next character that ends an unquoted string.
+    size_t nextJsonSpecial(size_t pos) noexcept
+    {
+        return find(pos, [](BlockMasks const &m) {
+            return m.control | m.whitespace | m.quote | m.comma | m.colon | m.bracket | m.brace;
+        });
+    }
+
+    /// The end of a run of word characters and non-ASCII characters that
+    /// strings keep as they are.
+    size_t nextNonBareWord(size_t pos) noexcept
+    {
+        return find(pos, [](BlockMasks const &m) { return ~(m.word | (m.nonAscii & ~m.utf8)); });
+    }
+
+    /// The next byte in [pos, limit) of a string literal that might need
+    /// rewriting. Everything before it can be copied through unchanged. '<',
+    /// '>' and ']' are only of interest when escaping embeddings.
+    template <bool ESCAPE_EMBEDDING = true>
+    size_t nextStringSpecial(size_t pos, size_t limit) noexcept
+    {
+        return find(pos, limit, [](BlockMasks const &m) {
+            auto special = m.control | m.quote | m.apostrophe | m.backslash | m.utf8;
+            if constexpr (ESCAPE_EMBEDDING) {
+                special |= m.angle | m.bracket;
+            }
+            return special;
+        });
+    }
+
+    /// The position of the first byte at or after pos that is selected by
+    /// quotes and not escaped by a backslash, or the input length. Backslashes
+    /// before pos are ignored.
+    size_t nextUnescaped(size_t pos, uint64_t BlockMasks::*quotes) noexcept
+    {
+        uint64_t escaped = 0;
+        auto     from    = ~uint64_t{0} << (pos % BLOCK_SIZE);
+        for (auto block = pos / BLOCK_SIZE; block * BLOCK_SIZE < _input.length(); ++block) {
+            auto const &masks   = masksFor(block);
+            auto const  escapes = escapedBytes(masks.backslash & _valid & from, escaped);
+            auto const  bits    = (masks.*quotes) & _valid & from & ~escapes;
+            if (bits != 0) {
+                return block * BLOCK_SIZE + trailingZeroes(bits);
+            }
+            from = ~uint64_t{0};
+        }
+        return _input.length();
+    }
+
+    /// The next candidate end of a // comment.
+    size_t nextLineBreak(size_t pos) noexcept
+    {
+        return find(pos, [](BlockMasks const &m) { return m.lineBreak; });
+    }
+};
+
+} // namespace com::google::json::detail
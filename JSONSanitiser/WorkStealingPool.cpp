@@ -0,0 +1,171 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "WorkStealingPool.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace com::google::json::detail {
+
+namespace {
+
+// The pool and queue of a worker thread.
+thread_local WorkStealingPool const *t_pool  = nullptr;
+thread_local size_t                  t_queue = 0;
+
+// Waits are timed, with the condition checked again on waking. The untimed
+// wait needs a newer C++ runtime than anything else in the library.
+constexpr auto IDLE_WAIT = std::chrono::milliseconds{100};
+
+} // namespace
+
+WorkStealingPool::WorkStealingPool(unsigned threads)
+{
+    for (unsigned i = 0; i <= threads; ++i) {
+        _queues.push_back(std::make_unique<Queue>());
+    }
+    _workers.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i) {
+        _workers.emplace_back([this, i] { work(i); });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock{_sleep};
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto &worker : _workers) {
+        worker.join();
+    }
+}
+
+WorkStealingPool &WorkStealingPool::shared()
+{
+    static WorkStealingPool pool{std::max(std::thread::hardware_concurrency(), 1u) - 1};
+    return pool;
+}
+
+size_t WorkStealingPool::ownQueue() const noexcept
+{
+    return (t_pool == this) ? t_queue : _workers.size();
+}
+
+void WorkStealingPool::push(size_t queue, Task const &task)
+{
+    {
+        std::lock_guard<std::mutex> lock{_queues[queue]->mutex};
+        _queues[queue]->tasks.push_back(task);
+    }
+    // Counted before taking the lock so that a thread going to sleep either
+    // sees it or is already waiting for the notification.
+    _queued.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock{_sleep};
+    }
+    _wake.notify_one();
+}
+
+bool WorkStealingPool::take(size_t queue, Task &task)
+{
+    // The newest task of our own, since it is the smallest and its input the
+    // most likely to be in cache.
+    {
+        auto                       &own = *_queues[queue];
+        std::lock_guard<std::mutex> lock{own.mutex};
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            _queued.fetch_sub(1);
+            return true;
+        }
+    }
+    // Otherwise the oldest task of another thread, which is the biggest.
+    for (size_t i = 1; i < _queues.size(); ++i) {
+        auto                       &other = *_queues[(queue + i) % _queues.size()];
+        std::lock_guard<std::mutex> lock{other.mutex};
+        if (!other.tasks.empty()) {
+            task = other.tasks.front();
+            other.tasks.pop_front();
+            _queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::execute(size_t queue, Task task)
+{
+    for (auto mid = task.job->split(task.begin, task.end);
+         (task.begin < mid) && (mid < task.end);
+         mid = task.job->split(task.begin, task.end)) {
+        push(queue, Task{task.job, task.progress, mid, task.end});
+        task.end = mid;
+    }
+    task.job->run(task.begin, task.end);
+    auto const count = task.end - task.begin;
+    if (task.progress->remaining.fetch_sub(count) == count) {
+        // The thread that ran the job may be asleep waiting for this.
+        {
+            std::lock_guard<std::mutex> lock{_sleep};
+        }
+        _wake.notify_all();
+    }
+}
+
+void WorkStealingPool::work(size_t queue)
+{
+    t_pool  = this;
+    t_queue = queue;
+    for (;;) {
+        Task task;
+        if (take(queue, task)) {
+            execute(queue, task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock{_sleep};
+        _wake.wait_for(lock, IDLE_WAIT, [this] { return _stop || (_queued.load() != 0); });
+        if (_stop) {
+            return;
+        }
+    }
+}
+
+void WorkStealingPool::run(Job const &job, size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    Progress progress;
+    progress.remaining.store(count);
+    auto const queue = ownQueue();
+    push(queue, Task{&job, &progress, 0, count});
+
+    // Help until the job is done, sleeping only when there is nothing to take.
+    while (progress.remaining.load() != 0) {
+        Task task;
+        if (take(queue, task)) {
+            execute(queue, task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock{_sleep};
+        _wake.wait_for(lock, IDLE_WAIT, [&] {
+            return (progress.remaining.load() == 0) || (_queued.load() != 0);
+        });
+    }
+}
+
+} // namespace com::google::json::detail
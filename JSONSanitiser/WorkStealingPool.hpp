@@ -0,0 +1,101 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The thread pool behind sanitizeBatch. Work is a range of indexes that is
+// split in half for as long as it is too big, and idle threads steal the
+// halves, so a few large documents do not leave most threads waiting.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace com::google::json::detail {
+
+class WorkStealingPool final
+{
+public:
+    /// Work to be done over a range of indexes.
+    struct Job
+    {
+        /// Where to split [begin, end) into two, or end to run it whole.
+        std::function<size_t(size_t begin, size_t end)> split;
+        /// Does the work for [begin, end). It must not throw.
+        std::function<void(size_t begin, size_t end)> run;
+    };
+
+    /// Starts threads workers. The threads that call run() also do work, so
+    /// a pool with no workers runs everything on the caller.
+    explicit WorkStealingPool(unsigned threads);
+    ~WorkStealingPool();
+
+    WorkStealingPool(WorkStealingPool const &) = delete;
+    WorkStealingPool &operator=(WorkStealingPool const &) = delete;
+
+    /// The number of threads that work on a job, counting the caller.
+    size_t threads() const noexcept
+    {
+        return _workers.size() + 1;
+    }
+
+    /// Runs job over [0, count) and returns when all of it is done.
+    void run(Job const &job, size_t count);
+
+    /// A pool with a worker for each hardware thread but the caller's.
+    static WorkStealingPool &shared();
+
+private:
+    struct Progress
+    {
+        std::atomic<size_t> remaining;
+    };
+
+    struct Task
+    {
+        Job const *job;
+        Progress  *progress;
+        size_t     begin;
+        size_t     end;
+    };
+
+    // Each worker has its own queue. The last one is for threads that are not
+    // workers.
+    struct Queue
+    {
+        std::mutex       mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread>            _workers;
+    std::atomic<size_t>                 _queued{0};
+    std::mutex                          _sleep;
+    std::condition_variable             _wake;
+    bool                                _stop = false;
+
+    size_t ownQueue() const noexcept;
+    void   push(size_t queue, Task const &task);
+    bool   take(size_t queue, Task &task);
+    void   execute(size_t queue, Task task);
+    void   work(size_t queue);
+};
+
+} // namespace com::google::json::detail
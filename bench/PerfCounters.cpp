@@ -0,0 +1,134 @@
+// Copyright (C) 2020 D Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "PerfCounters.hpp"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#endif
+
+namespace bench {
+
+#if defined(__linux__)
+
+namespace {
+
+struct EventConfig
+{
+    uint32_t type;
+    uint64_t config;
+};
+
+constexpr uint64_t cacheEvent(uint64_t cache, uint64_t op, uint64_t result) noexcept
+{
+    return cache | (op << 8) | (result << 16);
+}
+
+constexpr std::array<EventConfig, PerfCounters::EVENT_COUNT> EVENTS = {{
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, cacheEvent(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                                    PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+}};
+
+// The value of a counter and how long it was enabled and actually counting.
+struct Reading
+{
+    uint64_t value;
+    uint64_t enabled;
+    uint64_t running;
+};
+
+} // namespace
+
+PerfCounters::PerfCounters() noexcept
+{
+    for (size_t i = 0; i < EVENT_COUNT; ++i) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = EVENTS[i].type;
+        attr.config         = EVENTS[i].config;
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        _fds[i] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (auto const fd : _fds) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+}
+
+void PerfCounters::start() noexcept
+{
+    for (auto const fd : _fds) {
+        if (fd >= 0) {
+            ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::stop() noexcept
+{
+    for (auto const fd : _fds) {
+        if (fd >= 0) {
+            ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (size_t i = 0; i < EVENT_COUNT; ++i) {
+        Reading reading;
+        if ((_fds[i] < 0) || (::read(_fds[i], &reading, sizeof(reading)) != sizeof(reading))) {
+            _values[i] = 0;
+            continue;
+        }
+        _values[i] = static_cast<double>(reading.value);
+        if ((reading.running != 0) && (reading.running < reading.enabled)) {
+            _values[i] *=
+                static_cast<double>(reading.enabled) / static_cast<double>(reading.running);
+        }
+    }
+}
+
+#else
+
+PerfCounters::PerfCounters() noexcept
+{
+    _fds.fill(-1);
+}
+
+PerfCounters::~PerfCounters() = default;
+
+void PerfCounters::start() noexcept
+{}
+
+void PerfCounters::stop() noexcept
+{}
+
+#endif
+
+} // namespace bench
@@ -0,0 +1,72 @@
+// Copyright (C) 2020 D Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Hardware counters for the benchmarks, read through perf_event_open on
+// Linux. Events the kernel or CPU does not offer, for example in a virtual
+// machine without a PMU, are left out, and elsewhere there are none.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace bench {
+
+class PerfCounters final
+{
+public:
+    enum Event
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        BRANCH_MISSES,
+        L1D_READ_MISSES,
+        LLC_MISSES,
+        EVENT_COUNT
+    };
+
+    /// Opens the counters for the calling thread, stopped.
+    PerfCounters() noexcept;
+
+    PerfCounters(PerfCounters const &) = delete;
+    PerfCounters &operator=(PerfCounters const &) = delete;
+
+    ~PerfCounters();
+
+    /// Zeroes the counters and starts them.
+    void start() noexcept;
+
+    /// Stops the counters and reads them.
+    void stop() noexcept;
+
+    /// Whether event could be opened.
+    bool has(Event event) const noexcept
+    {
+        return _fds[event] >= 0;
+    }
+
+    /// The count between the last start() and stop(), scaled up if the kernel
+    /// had to share the hardware counters between events.
+    double value(Event event) const noexcept
+    {
+        return _values[event];
+    }
+
+private:
+    std::array<int, EVENT_COUNT>    _fds;
+    std::array<double, EVENT_COUNT> _values = {};
+};
+
+} // namespace bench
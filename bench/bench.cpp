@@ -0,0 +1,288 @@
+// Copyright (C) 2020 D Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <benchmark/benchmark.h>
+
+#include "PerfCounters.hpp"
+
+#include <BasicJsonSanitizer.hpp>
+#include <JSONSanitiser.hpp>
+#include <SanitizeDispatch.hpp>
+#include <StructuralIndex.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+
+using namespace com::google::json;
+
+namespace {
+
+// Every allocation made through the global operator new, including those the
+// library makes.
+std::atomic<uint64_t> allocations{0};
+
+} // namespace
+
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto *const p = std::malloc((size != 0) ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    std::free(p);
+}
+
+// std::pmr::new_delete_resource, which the library allocates from by default,
+// asks for its alignment explicitly.
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    auto const align = static_cast<size_t>(alignment);
+    if (auto *const p = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+// Each benchmark sanitizes an array of one fragment repeated to the size
+// under test, so the time is spent on the repair the fragment needs.
+
+constexpr std::string_view CLEAN =
+    R"({"id":12345,"name":"a plain string","tags":["x","y"],"ok":true,"none":null,"n":-1.5e3})";
+constexpr std::string_view COMMENTS = "/* block */ 1 // line\n";
+constexpr std::string_view SINGLE_QUOTED =
+    R"({'key':'a single quoted string','other':'it\'s "quoted"'})";
+constexpr std::string_view UNQUOTED_KEYS = R"({key:1,another_key:"v",$dollar:true,x:null})";
+constexpr std::string_view HEX_AND_OCTAL = "0x1F, 017, 0X7fffffff, -0x10, 0777";
+constexpr std::string_view NUMERIC_KEYS  = R"({1:1,0x10:"hex",1.50:true,-0:null,1e2:"exp"})";
+constexpr std::string_view HTML_EMBEDDING =
+    R"("</script><script>alert(1)</script><!-- comment --><![CDATA[ data ]]>")";
+constexpr std::string_view TRAILING_COMMAS = R"([1,2,3,],{"a":1,"b":2,},[,])";
+constexpr std::string_view NON_ASCII =
+    "\"caf\xc3\xa9 na\xc3\xafve \xe2\x98\x83 \xf0\x9f\x98\x80 \xe2\x80\xa8 \xe2\x80\xa9\"";
+constexpr std::string_view JS_ESCAPES = R"("\x41\v\0\101é\'\/\a")";
+constexpr std::string_view MALFORMED_UTF8 =
+    "\"caf\xc3 na\xc3\xafve \xe2\x98 \x80\xbf \xed\xa0\x80 \xc0\xaf \xf0\x9f\x98\x80\"";
+
+std::string deepNesting()
+{
+    // Well inside DEFAULT_NESTING_DEPTH once wrapped in the outer array.
+    constexpr int depth = 60;
+    std::string   fragment;
+    for (int i = 0; i < depth; ++i) {
+        fragment += (i % 2 == 0) ? "[" : "{\"k\":";
+    }
+    fragment += "0";
+    for (int i = depth; i-- > 0;) {
+        fragment += (i % 2 == 0) ? "]" : "}";
+    }
+    return fragment;
+}
+
+std::string makeDocument(std::string_view fragment, size_t size)
+{
+    std::string document{"["};
+    document.append(fragment);
+    while (document.length() + 1 < size) {
+        document.append(",");
+        document.append(fragment);
+    }
+    document.append("]");
+    return document;
+}
+
+/// Runs body once per iteration with the hardware counters going and reports
+/// them per byte of input, along with the allocations per document. Returns
+/// how long the iterations took.
+template <typename Body>
+double measure(benchmark::State &state, size_t bytes, Body body)
+{
+    bench::PerfCounters counters;
+    auto const          allocationsBefore = allocations.load();
+    auto const          start             = std::chrono::steady_clock::now();
+    counters.start();
+    for (auto _ : state) {
+        body();
+    }
+    counters.stop();
+    auto const seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto const runs  = static_cast<double>(state.iterations());
+    auto const total = runs * static_cast<double>(bytes);
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * static_cast<int64_t>(bytes));
+    state.counters["documents"] = benchmark::Counter(runs, benchmark::Counter::kIsRate);
+    state.counters["allocs/doc"] =
+        static_cast<double>(allocations.load() - allocationsBefore) / runs;
+
+    using Event = bench::PerfCounters::Event;
+    auto const perByte = [&](char const *name, Event event, double unit) {
+        if (counters.has(event)) {
+            state.counters[name] = counters.value(event) / (total / unit);
+        }
+    };
+    perByte("cycles/B", Event::CYCLES, 1);
+    perByte("instructions/B", Event::INSTRUCTIONS, 1);
+    perByte("branch-misses/KB", Event::BRANCH_MISSES, 1024);
+    perByte("L1d-misses/KB", Event::L1D_READ_MISSES, 1024);
+    perByte("LLC-misses/KB", Event::LLC_MISSES, 1024);
+    return seconds;
+}
+
+/// How long memcpy takes per byte of document, the bound for any single pass
+/// over it.
+double memcpySecondsPerByte(std::string const &document)
+{
+    std::string copy(document.length(), '\0');
+    auto const  runs  = std::max<size_t>(1, (64 << 20) / document.length());
+    auto const  start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < runs; ++i) {
+        std::memcpy(copy.data(), document.data(), document.length());
+        benchmark::DoNotOptimize(copy.data());
+        benchmark::ClobberMemory();
+    }
+    auto const seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds / static_cast<double>(runs * document.length());
+}
+
+void sanitize(benchmark::State &state, std::string fragment)
+{
+    auto const document = makeDocument(fragment, static_cast<size_t>(state.range(0)));
+    auto const roofline = memcpySecondsPerByte(document);
+    auto const seconds  = measure(state, document.length(), [&document]() {
+        auto const result = JsonSanitizer::sanitizeToResult(document);
+        benchmark::DoNotOptimize(result.data());
+    });
+    // How many times slower than copying the document.
+    auto const bytes           = static_cast<double>(state.iterations() * document.length());
+    state.counters["x memcpy"] = (seconds / bytes) / roofline;
+}
+
+struct Utf8ReplacingPolicy : DefaultSanitizerPolicy
+{
+    static inline constexpr Utf8Repair UTF8_REPAIR = Utf8Repair::REPLACE;
+};
+
+/// The same with malformed UTF-8 replaced, as a validating caller would.
+void replaceUtf8(benchmark::State &state, std::string fragment)
+{
+    auto const document = makeDocument(fragment, static_cast<size_t>(state.range(0)));
+    measure(state, document.length(), [&document]() {
+        auto const result = BasicJsonSanitizer<Utf8ReplacingPolicy>::sanitizeToResult(document);
+        benchmark::DoNotOptimize(result.data());
+    });
+}
+
+/// The same through sanitizeAdaptive(), which pools the sanitizer for short
+/// documents and goes parallel for long ones when there are threads to spare.
+void adaptive(benchmark::State &state, std::string fragment)
+{
+    auto const document = makeDocument(fragment, static_cast<size_t>(state.range(0)));
+    measure(state, document.length(), [&document]() {
+        auto const result = sanitizeAdaptive(document);
+        benchmark::DoNotOptimize(result.data());
+    });
+    state.SetLabel(SanitizeStats::name(chooseEngine(profileInput(document, 16), {})));
+}
+
+void copy(benchmark::State &state)
+{
+    auto const  document = makeDocument(CLEAN, static_cast<size_t>(state.range(0)));
+    std::string copy(document.length(), '\0');
+    measure(state, document.length(), [&]() {
+        std::memcpy(copy.data(), document.data(), document.length());
+        benchmark::DoNotOptimize(copy.data());
+        benchmark::ClobberMemory();
+    });
+}
+
+void sizes(benchmark::internal::Benchmark *b)
+{
+    b->Arg(256)->Arg(16 << 10)->Arg(1 << 20);
+}
+
+/// Classifies a document block by block with one of the implementations the
+/// sanitizer chooses between.
+void classify(benchmark::State &state, detail::BlockClassifier classifier)
+{
+    auto const document = makeDocument(CLEAN, static_cast<size_t>(state.range(0)));
+    auto const blocks   = document.length() / detail::BLOCK_SIZE;
+    auto const data     = reinterpret_cast<unsigned char const *>(document.data());
+    measure(state, blocks * detail::BLOCK_SIZE, [&]() {
+        detail::BlockMasks masks;
+        for (size_t i = 0; i < blocks; ++i) {
+            classifier.classify(data + i * detail::BLOCK_SIZE, masks);
+            benchmark::DoNotOptimize(masks);
+        }
+    });
+}
+
+// One per implementation this host can run.
+int const classifyBenchmarks = []() {
+    for (auto const &classifier : detail::blockClassifiers()) {
+        auto const name = std::string{"classify/"} + classifier.name;
+        benchmark::RegisterBenchmark(name.c_str(), classify, classifier)->Apply(sizes);
+    }
+    benchmark::AddCustomContext("classifier", detail::blockClassifier().name);
+    return 0;
+}();
+
+} // namespace
+
+BENCHMARK(copy)->Name("memcpy")->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, Clean, std::string{CLEAN})->Arg(64)->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, Comments, std::string{COMMENTS})->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, SingleQuoted, std::string{SINGLE_QUOTED})->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, UnquotedKeys, std::string{UNQUOTED_KEYS})->Arg(64)->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, HexAndOctal, std::string{HEX_AND_OCTAL})->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, NumericKeys, std::string{NUMERIC_KEYS})->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, HtmlEmbedding, std::string{HTML_EMBEDDING})->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, DeepNesting, deepNesting())->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, TrailingCommas, std::string{TRAILING_COMMAS})->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, NonAscii, std::string{NON_ASCII})->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, JsEscapes, std::string{JS_ESCAPES})->Apply(sizes);
+BENCHMARK_CAPTURE(sanitize, MalformedUtf8, std::string{MALFORMED_UTF8})->Apply(sizes);
+BENCHMARK_CAPTURE(replaceUtf8, NonAscii, std::string{NON_ASCII})->Apply(sizes);
+BENCHMARK_CAPTURE(replaceUtf8, MalformedUtf8, std::string{MALFORMED_UTF8})->Apply(sizes);
+BENCHMARK_CAPTURE(adaptive, Clean, std::string{CLEAN})->Arg(64)->Apply(sizes);
+BENCHMARK_CAPTURE(adaptive, UnquotedKeys, std::string{UNQUOTED_KEYS})->Arg(64)->Apply(sizes);
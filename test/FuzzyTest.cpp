@@ -12,7 +12,11 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <BasicJsonSanitizer.hpp>
 #include <JSONSanitiser.hpp>
+#include <SanitizeBatch.hpp>
+#include <SanitizeDispatch.hpp>
+#include <StructuralIndex.hpp>
 #include <boost/coroutine2/coroutine.hpp>
 #include <boost/multiprecision/cpp_int.hpp>
 #include <gtest/gtest.h>
@@ -31,6 +35,7 @@
 #include <random>
 #include <string>
 #include <sstream>
+#include <stdexcept>
 #include <string_view>
 #include <type_traits>
 #include <utility>
@@ -552,3 +557,156 @@ TEST(TestFuzzer, Fuzz)
         ASSERT_EQ(sanitised, sanitised1) << "Failed on " << asHex(s) << " ==> " << asHex(sanitised);
     }
 }
+
+TEST(TestFuzzer, FuzzStream)
+{
+    auto const          nIterations = 2000;
+    RandomJSONGenerator rjg{nIterations};
+    rjg.init();
+    std::mt19937                          generator{std::random_device{}()};
+    std::uniform_int_distribution<size_t> chunkSize{1, 64};
+    for (auto s : rjg) {
+        std::string sanitised;
+        try {
+            sanitised = asString(JsonSanitizer::sanitize(s));
+        } catch (...) {
+            continue;
+        }
+        JsonSanitizerStream stream;
+        std::string         streamed;
+        for (size_t i = 0; i < s.length();) {
+            auto const n = std::min(chunkSize(generator), s.length() - i);
+            streamed.append(stream.feed(std::string_view{s}.substr(i, n)));
+            i += n;
+        }
+        streamed.append(stream.finish());
+        ASSERT_EQ(streamed, sanitised) << "Failed on " << asHex(s);
+    }
+}
+
+TEST(TestFuzzer, FuzzParallel)
+{
+    auto const          nIterations = 2000;
+    RandomJSONGenerator rjg{nIterations};
+    rjg.init();
+    std::mt19937                          generator{std::random_device{}()};
+    std::uniform_int_distribution<size_t> grainSize{1, 64};
+    BatchOptions                          options;
+    options.threads = 3;
+    for (auto s : rjg) {
+        std::string sanitised;
+        try {
+            sanitised = asString(JsonSanitizer::sanitize(s));
+        } catch (...) {
+            continue;
+        }
+        options.grainSize = grainSize(generator);
+        ASSERT_EQ(sanitizeParallel(s, options).str(), sanitised) << "Failed on " << asHex(s);
+    }
+}
+
+TEST(TestFuzzer, FuzzStats)
+{
+    auto const          nIterations = 2000;
+    RandomJSONGenerator rjg{nIterations};
+    rjg.init();
+    for (auto s : rjg) {
+        SanitizeStats stats;
+        std::string   sanitised;
+        try {
+            sanitised = std::string{JsonSanitizer::sanitizeToResult(s, stats).view()};
+        } catch (...) {
+            continue;
+        }
+        ASSERT_EQ(stats.outputBytes(), sanitised.length()) << "Failed on " << asHex(s);
+    }
+}
+
+TEST(TestFuzzer, FuzzAdaptive)
+{
+    auto const          nIterations = 2000;
+    RandomJSONGenerator rjg{nIterations};
+    rjg.init();
+    // Low enough that every engine gets some of the documents.
+    DispatchOptions options;
+    options.threads                   = 3;
+    options.grainSize                 = 16;
+    options.pooledMaximumBytes        = 32;
+    options.parallelMinimumBytes      = 256;
+    options.denseParallelMinimumBytes = 64;
+    SanitizeStats stats;
+    for (auto s : rjg) {
+        std::string sanitised;
+        try {
+            sanitised = asString(JsonSanitizer::sanitize(s));
+        } catch (...) {
+            continue;
+        }
+        ASSERT_EQ(sanitizeAdaptive(s, stats, options).view(), sanitised) << "Failed on " << asHex(s);
+    }
+    ASSERT_GT(stats.count(Engine::POOLED), 0u);
+    ASSERT_GT(stats.count(Engine::SERIAL), 0u);
+    ASSERT_GT(stats.count(Engine::PARALLEL), 0u);
+}
+
+struct ReplacingPolicy : DefaultSanitizerPolicy
+{
+    static inline constexpr Utf8Repair UTF8_REPAIR = Utf8Repair::REPLACE;
+};
+
+TEST(TestFuzzer, FuzzUtf8Repair)
+{
+    using ReplacingJsonSanitizer = BasicJsonSanitizer<ReplacingPolicy>;
+    auto const          nIterations = 2000;
+    RandomJSONGenerator rjg{nIterations};
+    rjg.init();
+    for (auto s : rjg) {
+        SanitizeStats stats;
+        std::string   sanitised;
+        try {
+            sanitised = std::string{ReplacingJsonSanitizer::sanitizeToResult(s, stats).view()};
+        } catch (...) {
+            continue;
+        }
+        ASSERT_EQ(stats.outputBytes(), sanitised.length()) << "Failed on " << asHex(s);
+        for (size_t i = 0; i < sanitised.length();) {
+            auto const ch = com::google::json::detail::utf8::char_at(sanitised, i);
+            ASSERT_TRUE(com::google::json::detail::utf8::is_well_formed(ch))
+                << "Failed on " << asHex(s) << " ==> " << asHex(sanitised);
+            i += ch.length();
+        }
+        ASSERT_EQ(asString(ReplacingJsonSanitizer::sanitize(sanitised)), sanitised)
+            << "Failed on " << asHex(s);
+    }
+}
+
+TEST(TestFuzzer, FuzzClassifiers)
+{
+    // Puts back the classifier the host would use, however the test ends.
+    struct Restore
+    {
+        detail::BlockClassifier const classifier = detail::blockClassifier();
+        ~Restore() { detail::setBlockClassifier(classifier); }
+    } const restore;
+
+    auto const          classifiers = detail::blockClassifiers();
+    auto const          nIterations = 2000;
+    RandomJSONGenerator rjg{nIterations};
+    rjg.init();
+    for (auto s : rjg) {
+        std::string expected;
+        for (auto const &classifier : classifiers) {
+            detail::setBlockClassifier(classifier);
+            std::string sanitised;
+            try {
+                sanitised = asString(JsonSanitizer::sanitize(s));
+            } catch (std::out_of_range const &) {
+                sanitised = "out_of_range";
+            }
+            if (&classifier == &classifiers.front()) {
+                expected = sanitised;
+            }
+            ASSERT_EQ(sanitised, expected) << classifier.name << " failed on " << asHex(s);
+        }
+    }
+}
@@ -14,14 +14,28 @@
 // limitations under the License.
 #include <gtest/gtest.h>
 
+#include <BasicJsonSanitizer.hpp>
 #include <JSONSanitiser.hpp>
+#include <SanitizeBatch.hpp>
+#include <SanitizeDispatch.hpp>
+#include <SanitizerArena.hpp>
+#include <SanitizerContext.hpp>
+#include <StructuralIndex.hpp>
 
+#include <array>
 #include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <type_traits>
+#include <utility>
 #include <variant>
+#include <vector>
 
 using namespace com::google::json;
 
@@ -152,6 +166,13 @@ TEST(SanitizerTests, TestArrayRepeatedAndTrailingComma)
     ASSERT_EQ(asString(JsonSanitizer::sanitize("[1,,3,]")), "[1,null,3]");
 }
 
+TEST(SanitizerTests, TestTrailingCommaBeforeComment)
+{
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("[1,2, /* x */ ]")), "[1,2 ]");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("{\"a\":1,,// x\n}")), "{\"a\":1}");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("[1,,\n")), "[1,null]");
+}
+
 TEST(SanitizerTests, TestArrayNoElementSeparator)
 {
     ASSERT_EQ(asString(JsonSanitizer::sanitize("[1 2 3]")), "[1 ,2 ,3]");
@@ -546,6 +567,873 @@ TEST(SanitizerTests, TestOddOctalRecode)
     ASSERT_EQ(asString(JsonSanitizer::sanitize("-016923547559")), "-2035208041");
 }
 
+TEST(SanitizerTests, TestBackslashRuns)
+{
+    // Runs of backslashes before a quote, either side of the 64 byte blocks.
+    for (auto n = 0; n < 200; ++n) {
+        auto const json = "[\"" + std::string(n, '\\') + ((n % 2) ? "\"\"" : "\"") + ",1]";
+        ASSERT_EQ(asString(JsonSanitizer::sanitize(json)), json);
+    }
+}
+
+TEST(SanitizerTests, TestValidPrefix)
+{
+    // Strict JSON comes back as a view of the input.
+    auto const valid = std::string{"{\"a\": [1, -2.5e+3, true, null, \"\xc3\xa4\\u00e4\\n\"],\n"
+                                   " \"b\": {\"c\": []}}"};
+    auto const result = JsonSanitizer::sanitize(valid);
+    ASSERT_TRUE(std::holds_alternative<std::string_view>(result));
+    ASSERT_EQ(asString(result), valid);
+
+    // Repair starts part way through, with the brackets and state so far.
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("{\"a\": [[1, 2], {\"b\": [3, 010, ]}]")),
+              "{\"a\": [[1, 2], {\"b\": [3, 8 ]}]}");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("[\"x\", {\"y\": \"<!--\"}]")),
+              "[\"x\", {\"y\": \"\\u003c!--\"}]");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("[1, 2,\n]")), "[1, 2\n]");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("{\"a\": 1 \"b\": 2}")), "{\"a\": 1 ,\"b\": 2}");
+
+    auto const depth = JsonSanitizer::DEFAULT_NESTING_DEPTH;
+    auto const deep  = std::string(depth, '[') + std::string(depth, ']');
+    ASSERT_EQ(asString(JsonSanitizer::sanitize(deep)), deep);
+    ASSERT_THROW(JsonSanitizer::sanitize("[" + deep + "]"), std::out_of_range);
+}
+
+TEST(SanitizerTests, TestOctalUnderflow)
+{
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("[-01777777777777777777777, 1]")), "[1, 1]");
+}
+
+std::string sanitizeInChunks(std::string_view json, size_t chunkSize)
+{
+    JsonSanitizerStream stream;
+    std::string         sanitized;
+    for (size_t i = 0; i < json.length(); i += chunkSize) {
+        sanitized.append(stream.feed(json.substr(i, chunkSize)));
+    }
+    sanitized.append(stream.finish());
+    return sanitized;
+}
+
+TEST(StreamTests, TestSameAsWhole)
+{
+    for (std::string_view json :
+         {"", "  ", "false", "{ foo: ['bar", "[1,2, /* x */ ]", "{\"a\":1,,// x\n}",
+          "[1 2 3]", "\"<script>foo()</script>\"", "[\"\xe2\x80\xa8\", 012, .5e-1]",
+          "{'a' : 'b', 'c' : [true, null, ]}", "false,true", "[1,,\n"}) {
+        auto const whole = asString(JsonSanitizer::sanitize(json));
+        for (size_t chunkSize = 1; chunkSize <= json.length(); ++chunkSize) {
+            ASSERT_EQ(sanitizeInChunks(json, chunkSize), whole) << json << " in " << chunkSize;
+        }
+    }
+}
+
+TEST(StreamTests, TestOutputIsNotHeldBack)
+{
+    // Only the trailing comma, and the last few bytes in case a token carries
+    // on past them, wait for more input.
+    JsonSanitizerStream stream;
+    ASSERT_EQ(stream.feed("[1, 'a', {\"b\": 2},\n\n\n\n\n\n"), "[1, \"a\", {\"b\": 2}");
+    ASSERT_EQ(stream.feed("]"), "");
+    ASSERT_EQ(stream.finish(), "\n\n\n\n\n\n]");
+    // The stream starts again after finish().
+    ASSERT_EQ(stream.feed("'x"), "");
+    ASSERT_EQ(stream.finish(), "\"x\"");
+}
+
+TEST(SinkTests, TestStringSink)
+{
+    std::string out;
+    StringSink  sink{out};
+    JsonSanitizer::sanitize("{ foo: ['bar", sink);
+    ASSERT_EQ(out, "{ \"foo\": [\"bar\"]}");
+}
+
+TEST(SinkTests, TestBufferSink)
+{
+    char       buffer[16];
+    BufferSink fits{buffer, sizeof(buffer)};
+    JsonSanitizer::sanitize("[1,2,3,]", fits);
+    ASSERT_FALSE(fits.overflowed());
+    ASSERT_EQ(fits.view(), "[1,2,3]");
+
+    BufferSink tooSmall{buffer, 4};
+    JsonSanitizer::sanitize("[1,2,3,]", tooSmall);
+    ASSERT_TRUE(tooSmall.overflowed());
+    ASSERT_EQ(tooSmall.size(), 7u);
+    ASSERT_EQ(tooSmall.view(), "[1,2");
+}
+
+TEST(SinkTests, TestOutputIteratorSink)
+{
+    std::vector<char>  out;
+    OutputIteratorSink sink{std::back_inserter(out)};
+    JsonSanitizer::sanitize("'<script>'", sink);
+    ASSERT_EQ(std::string(out.begin(), out.end()), "\"\\u003cscript>\"");
+}
+
+TEST(SinkTests, TestOstreamSink)
+{
+    std::ostringstream out;
+    OstreamSink        sink{out};
+    JsonSanitizer::sanitize("  false ", sink);
+    ASSERT_EQ(out.str(), "  false ");
+}
+
+TEST(SinkTests, TestCallbackSink)
+{
+    std::string         out;
+    CallbackSink        sink{[&out](std::string_view s) { out.append(s); }};
+    JsonSanitizerStream stream;
+    stream.feed("{\"a\": [1, 2,", sink);
+    stream.feed(" 3, ]", sink);
+    stream.finish(sink);
+    ASSERT_EQ(out, "{\"a\": [1, 2, 3 ]}");
+}
+
+#if !defined(_WIN32)
+TEST(SinkTests, TestFdSink)
+{
+    auto *file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    {
+        FdSink sink{fileno(file), 4};
+        JsonSanitizer::sanitize("[\"abc\", 'def', ghi]", sink);
+    }
+    std::rewind(file);
+    char buffer[64] = {};
+    auto n          = std::fread(buffer, 1, sizeof(buffer), file);
+    std::fclose(file);
+    ASSERT_EQ(std::string_view(buffer, n), "[\"abc\", \"def\", \"ghi\"]");
+}
+#endif
+
+TEST(ResultTests, TestValidInputIsBorrowed)
+{
+    std::string_view const input  = "{\"a\": [1, 2]}";
+    auto const             result = JsonSanitizer::sanitizeToResult(input);
+    ASSERT_TRUE(result.aliasesInput());
+    ASSERT_EQ(result.data(), input.data());
+    ASSERT_EQ(result.view(), input);
+}
+
+TEST(ResultTests, TestSmallOutput)
+{
+    std::string input  = "[a]";
+    auto        result = JsonSanitizer::sanitizeToResult(input);
+    input.assign(input.length(), 'x');
+    ASSERT_FALSE(result.aliasesInput());
+    ASSERT_EQ(result.view(), "[\"a\"]");
+
+    // Still valid after the result moves.
+    auto moved = std::move(result);
+    ASSERT_EQ(moved.view(), "[\"a\"]");
+}
+
+TEST(ResultTests, TestLargeOutputIsMovedOut)
+{
+    auto const input  = "[" + std::string(100, 'a') + "]";
+    auto       result = JsonSanitizer::sanitizeToResult(input);
+    ASSERT_FALSE(result.aliasesInput());
+    ASSERT_EQ(result.size(), input.length() + 2);
+    auto const data = result.data();
+    auto const str  = std::move(result).release();
+    ASSERT_EQ(str.data(), data);
+    ASSERT_EQ(std::string_view{str}, "[\"" + std::string(100, 'a') + "\"]");
+}
+
+TEST(ResultTests, TestSameAsSanitize)
+{
+    for (std::string_view input : {"", "[1, 2, 3]", "{a: 1, 'b': [2,]}", "[[[", "[1,]"}) {
+        ASSERT_EQ(JsonSanitizer::sanitizeToResult(input).str(),
+                  asString(JsonSanitizer::sanitize(input)));
+    }
+}
+
+TEST(ArenaTests, TestResultsAreAllocatedFromArena)
+{
+    // Nothing may come from anywhere but the buffer.
+    alignas(std::max_align_t) char buffer[4096];
+    SanitizerArena arena{buffer, sizeof(buffer), std::pmr::null_memory_resource()};
+
+    auto const input = "{a: [" + std::string(100, '1') + ", b]}";
+    auto const small = JsonSanitizer::sanitizeToResult("[a]", &arena);
+    auto const large = JsonSanitizer::sanitizeToResult(input, &arena);
+    ASSERT_EQ(small.view(), "[\"a\"]");
+    ASSERT_EQ(large.view(), "{\"a\": [" + std::string(100, '1') + ", \"b\"]}");
+    ASSERT_GE(large.data(), buffer);
+    ASSERT_LT(large.data(), buffer + sizeof(buffer));
+    ASSERT_GT(arena.allocated(), input.length());
+
+    arena.release();
+    ASSERT_EQ(arena.allocated(), 0u);
+    ASSERT_THROW(JsonSanitizer::sanitizeToResult(std::string(8192, 'a'), &arena),
+                 std::bad_alloc);
+}
+
+TEST(ArenaTests, TestContext)
+{
+    SanitizerArena   arena;
+    SanitizerContext context{&arena, 4};
+    ASSERT_EQ(context.sanitize("[[a]]"), "[[\"a\"]]");
+    ASSERT_GT(arena.allocated(), 0u);
+    ASSERT_THROW(context.sanitize("[[[[[1]]]]]"), std::out_of_range);
+}
+
+TEST(BatchTests, TestSameAsSanitize)
+{
+    std::vector<std::string> inputs;
+    for (int i = 0; i < 500; ++i) {
+        switch (i % 5) {
+            case 0:
+                inputs.push_back("[" + std::to_string(i) + ", 'x']");
+                break;
+            case 1:
+                inputs.push_back("");
+                break;
+            case 2:
+                inputs.push_back("{\"a\": " + std::to_string(i) + "}");
+                break;
+            case 3:
+                inputs.push_back("[" + std::string(static_cast<size_t>(i) * 10, 'a') + "]");
+                break;
+            default:
+                inputs.push_back("{a: [1, 2,], b: <!--");
+                break;
+        }
+    }
+    std::vector<std::string_view> const documents(inputs.begin(), inputs.end());
+
+    for (unsigned threads : {0u, 1u, 4u}) {
+        for (size_t grainSize : {size_t{1}, size_t{1000}, BatchOptions{}.grainSize}) {
+            BatchOptions options;
+            options.threads   = threads;
+            options.grainSize = grainSize;
+            auto const results = sanitizeBatch(documents, options);
+            ASSERT_EQ(results.size(), documents.size());
+            for (size_t i = 0; i < documents.size(); ++i) {
+                ASSERT_EQ(results[i].str(), asString(JsonSanitizer::sanitize(documents[i])));
+            }
+        }
+    }
+    ASSERT_TRUE(sanitizeBatch(std::vector<std::string_view>{}).empty());
+}
+
+TEST(BatchTests, TestFirstErrorIsRethrown)
+{
+    std::vector<std::string_view> const documents = {"[1]", "[[[[1]]]]", "[2]", "{{{{"};
+    BatchOptions                        options;
+    options.maximumNestingDepth = 2;
+    options.threads             = 2;
+    options.grainSize           = 1;
+    ASSERT_THROW(sanitizeBatch(documents, options), std::out_of_range);
+}
+
+TEST(ParallelTests, TestSameAsSanitize)
+{
+    std::string valid = "[";
+    for (int i = 0; i < 200; ++i) {
+        valid += "{\"id\": " + std::to_string(i * 7919) + ", \"name\": \"item \\\"" +
+                 std::to_string(i) + "\\\" \\\\\", \"ok\": true, \"v\": [-1.5e+3, null, false],\n" +
+                 " \"text\": \"" + std::string(static_cast<size_t>(i % 37), 'x') + "\"},";
+    }
+    valid += "{}]";
+    std::vector<std::string> const inputs = {
+        valid,
+        valid.substr(0, valid.length() / 2),
+        valid.substr(0, 3000) + "'oops', 010, }" + valid.substr(3000),
+        valid.substr(0, 5000) + "<!--" + valid.substr(5000),
+        "  \n" + valid + "  ",
+        "[" + std::string(1000, '1') + "]",
+        "\"" + std::string(1000, '\\') + "\"",
+        "{\"a\": \"\\\"\\\"\\\"\"" + std::string(500, ' ') + ", \"b\": [[[[]]]]}",
+    };
+    for (auto const &input : inputs) {
+        auto const expected = asString(JsonSanitizer::sanitize(input));
+        for (size_t grainSize : {size_t{1}, size_t{3}, size_t{7}, size_t{64}, size_t{1000}}) {
+            BatchOptions options;
+            options.threads   = 3;
+            options.grainSize = grainSize;
+            ASSERT_EQ(sanitizeParallel(input, options).str(), expected);
+
+            std::string out;
+            StringSink  sink{out};
+            sanitizeParallel(input, sink, options);
+            ASSERT_EQ(out, expected);
+        }
+    }
+}
+
+TEST(ParallelTests, TestValidInputIsBorrowed)
+{
+    auto const   input = "[" + std::string(100, '1') + ", \"" + std::string(100, 'a') + "\"]";
+    BatchOptions options;
+    options.threads   = 2;
+    options.grainSize = 16;
+    auto const result = sanitizeParallel(input, options);
+    ASSERT_TRUE(result.aliasesInput());
+    ASSERT_EQ(result.view(), input);
+}
+
+std::string sanitizeRecordsToString(std::string_view input, RecordFraming framing,
+                                    BatchOptions const &options = {})
+{
+    std::string out;
+    StringSink  sink{out};
+    sanitizeRecords(input, framing, sink, options);
+    return out;
+}
+
+std::string lengthPrefixed(std::vector<std::string> const &records)
+{
+    std::string out;
+    for (auto const &record : records) {
+        auto const length = record.length();
+        out += static_cast<char>(length >> 24);
+        out += static_cast<char>(length >> 16);
+        out += static_cast<char>(length >> 8);
+        out += static_cast<char>(length);
+        out += record;
+    }
+    return out;
+}
+
+TEST(RecordTests, TestLines)
+{
+    ASSERT_EQ(sanitizeRecordsToString("{a: 1}\r\n\n  [1,]  \n'x'", RecordFraming::LINES),
+              "{\"a\": 1}\n[1]\n\"x\"\n");
+    // A raw line break in a string splits the record, and each half is
+    // sanitized on its own.
+    ASSERT_EQ(sanitizeRecordsToString("{\"a\": \"x\ny\"}\n[2]\n", RecordFraming::LINES),
+              asString(JsonSanitizer::sanitize("{\"a\": \"x")) + "\n" +
+                  asString(JsonSanitizer::sanitize("y\"}")) + "\n[2]\n");
+    ASSERT_EQ(sanitizeRecordsToString("", RecordFraming::LINES), "");
+}
+
+TEST(RecordTests, TestRecordSeparator)
+{
+    ASSERT_EQ(sanitizeRecordsToString("\x1e{a: 1}\n\x1e\n\x1e[\"x\ny\"\n",
+                                      RecordFraming::RECORD_SEPARATOR),
+              "\x1e{\"a\": 1}\n\x1e[\"x\\ny\"]\n");
+}
+
+TEST(RecordTests, TestLengthPrefixed)
+{
+    ASSERT_EQ(sanitizeRecordsToString(lengthPrefixed({"{a: 1}", "", "[1,2]"}),
+                                      RecordFraming::LENGTH_PREFIXED),
+              lengthPrefixed({"{\"a\": 1}", "null", "[1,2]"}));
+    // A record cut short.
+    ASSERT_EQ(sanitizeRecordsToString(lengthPrefixed({"[1]"}) + std::string("\0\0\0\x09[2, ", 8),
+                                      RecordFraming::LENGTH_PREFIXED),
+              lengthPrefixed({"[1]", asString(JsonSanitizer::sanitize("[2, "))}));
+}
+
+TEST(RecordTests, TestParallelInOrder)
+{
+    std::string input;
+    std::string expected;
+    for (int i = 0; i < 2000; ++i) {
+        auto const spaces = std::string(static_cast<size_t>(i), ' ');
+        auto const record = (i % 3 == 0) ? "[" + std::to_string(i) + ",]" :
+                            (i % 3 == 1) ? "{a: [[[[[" + spaces + "1" :
+                                           "\"" + std::to_string(i) + "\"";
+        input += record + "\n";
+        expected += asString(JsonSanitizer::sanitize(record)) + "\n";
+    }
+    BatchOptions options;
+    options.threads   = 3;
+    options.grainSize = 100;
+    ASSERT_EQ(sanitizeRecordsToString(input, RecordFraming::LINES, options), expected);
+
+    // Too deep to sanitize.
+    options.maximumNestingDepth = 2;
+    ASSERT_EQ(sanitizeRecordsToString("[1]\n[[[1]]]\n[2]\n", RecordFraming::LINES, options),
+              "[1]\nnull\n[2]\n");
+}
+
+TEST(ContextTests, TestSameAsSanitize)
+{
+    SanitizerContext context;
+    for (std::string_view input : {"[1, 2, 3]", "{a: 1, 'b': [2,]}", "", "[[[", "\"\\u2028\"",
+                                   "[1, 2, 3]"}) {
+        ASSERT_EQ(std::string{context.sanitize(input)}, asString(JsonSanitizer::sanitize(input)));
+    }
+}
+
+TEST(ContextTests, TestBufferIsReused)
+{
+    SanitizerContext context;
+    auto const       first = context.sanitize("{a: 1, b: 2}");
+    ASSERT_EQ(first, "{\"a\": 1, \"b\": 2}");
+    auto const data   = first.data();
+    auto const second = context.sanitize("{c: 3}");
+    ASSERT_EQ(second, "{\"c\": 3}");
+    ASSERT_EQ(second.data(), data);
+}
+
+TEST(ContextTests, TestValidInputIsNotCopied)
+{
+    SanitizerContext       context;
+    std::string_view const input = "{\"a\":[1,2]}";
+    ASSERT_EQ(context.sanitize(input).data(), input.data());
+}
+
+TEST(ContextTests, TestNestingDepth)
+{
+    SanitizerContext context{2};
+    ASSERT_THROW(context.sanitize("[[[1]]]"), std::out_of_range);
+    context.setMaximumNestingDepth(3);
+    ASSERT_EQ(context.sanitize("[[[1]]]"), "[[[1]]]");
+}
+
+TEST(ContextTests, TestPoolReusesContexts)
+{
+    SanitizerContext *first = nullptr;
+    {
+        auto lease = SanitizerPool::acquire();
+        first      = &*lease;
+        ASSERT_EQ(lease->sanitize("[a]"), "[\"a\"]");
+    }
+    auto lease = SanitizerPool::acquire(8);
+    ASSERT_EQ(&*lease, first);
+    ASSERT_EQ(lease->getMaximumNestingDepth(), 8);
+    auto other = SanitizerPool::acquire();
+    ASSERT_NE(&*other, first);
+}
+
+TEST(StatsTests, TestRepairsAreCounted)
+{
+    SanitizeStats stats;
+    ASSERT_EQ(JsonSanitizer::sanitizeToResult("{a: 1, // c\n 'b': [.5,]}", stats).view(),
+              "{\"a\": 1,  \"b\": [0.5]}");
+    ASSERT_EQ(stats.documents, 1u);
+    ASSERT_EQ(stats.count(Repair::QUOTES_ADDED), 1u);
+    ASSERT_EQ(stats.added(Repair::QUOTES_ADDED), 2);
+    ASSERT_EQ(stats.count(Repair::COMMENT), 1u);
+    ASSERT_EQ(stats.added(Repair::COMMENT), -5);
+    ASSERT_EQ(stats.count(Repair::SINGLE_QUOTES), 1u);
+    ASSERT_EQ(stats.added(Repair::SINGLE_QUOTES), 0);
+    ASSERT_EQ(stats.count(Repair::NUMBER_NORMALIZED), 1u);
+    ASSERT_EQ(stats.added(Repair::NUMBER_NORMALIZED), 1);
+    ASSERT_EQ(stats.count(Repair::COMMA_ELIDED), 1u);
+    ASSERT_EQ(stats.added(Repair::COMMA_ELIDED), -1);
+    ASSERT_EQ(stats.count(Repair::NULL_ADDED), 0u);
+
+    // Stats add up over documents.
+    JsonSanitizer::sanitizeToResult("", stats);
+    JsonSanitizer::sanitizeToResult("[[1", stats);
+    JsonSanitizer::sanitizeToResult("[1]x;", stats);
+    ASSERT_EQ(stats.documents, 4u);
+    ASSERT_EQ(stats.count(Repair::NULL_ADDED), 1u);
+    ASSERT_EQ(stats.added(Repair::NULL_ADDED), 4);
+    ASSERT_EQ(stats.count(Repair::BRACKET_CLOSED), 2u);
+    ASSERT_EQ(stats.count(Repair::TRUNCATED), 1u);
+    ASSERT_EQ(stats.added(Repair::TRUNCATED), -2);
+}
+
+TEST(StatsTests, TestOutputBytesAddUp)
+{
+    for (std::string_view input :
+         {"", "[1, 2, 3]", "{a: 1, 'b': [2,]}", "[[[", "\"\\x41\\101\\u2028\"", "[1 2 {a b}]",
+          "\"<script>\xe2\x80\xa8</script>\"", "[-0x1F, 1e, +.5, 017]", "{1: [(x)], 2.50: ,}",
+          "'\xed\xa0\x80\x01'", "/* a */ [1] // b", "[1] [2]"}) {
+        SanitizeStats stats;
+        auto const    result = JsonSanitizer::sanitizeToResult(input, stats);
+        ASSERT_EQ(stats.inputBytes, input.length()) << input;
+        ASSERT_EQ(stats.outputBytes(), result.view().length()) << input;
+    }
+}
+
+TEST(StatsTests, TestValidInputHasNoRepairs)
+{
+    SanitizeStats stats;
+    JsonSanitizer::sanitizeToResult("{\"a\": [1, 2.5, \"\\u0041\", true, null]}", stats);
+    ASSERT_EQ(stats.documents, 1u);
+    for (size_t i = 0; i < REPAIR_KINDS; ++i) {
+        ASSERT_EQ(stats.repairs[i], 0u) << SanitizeStats::name(static_cast<Repair>(i));
+    }
+}
+
+TEST(StatsTests, TestContext)
+{
+    SanitizerContext context;
+    SanitizeStats    stats;
+    ASSERT_EQ(context.sanitizeToResult("[a,]", stats).view(), "[\"a\"]");
+    ASSERT_EQ(stats.count(Repair::QUOTES_ADDED), 1u);
+    ASSERT_EQ(stats.count(Repair::COMMA_ELIDED), 1u);
+    // The stats are not kept for later documents.
+    ASSERT_EQ(context.sanitizeToResult("[b]").view(), "[\"b\"]");
+    ASSERT_EQ(stats.count(Repair::QUOTES_ADDED), 1u);
+}
+
+TEST(StatsTests, TestProcessTotals)
+{
+    RepairStatistics::setEnabled(true);
+    auto const before = RepairStatistics::totals();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; ++t) {
+        threads.emplace_back([] {
+            for (int i = 0; i < 100; ++i) {
+                JsonSanitizer::sanitize("[a, /* b */ 1]");
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    JsonSanitizerStream stream;
+    stream.feed("['c'");
+    stream.finish();
+
+    RepairStatistics::setEnabled(false);
+    JsonSanitizer::sanitize("[d]");
+
+    auto totals = RepairStatistics::totals();
+    totals -= before;
+    ASSERT_EQ(totals.documents, 201u);
+    ASSERT_EQ(totals.inputBytes, 200u * 14 + 4);
+    ASSERT_EQ(totals.count(Repair::QUOTES_ADDED), 200u);
+    ASSERT_EQ(totals.count(Repair::COMMENT), 200u);
+    ASSERT_EQ(totals.count(Repair::SINGLE_QUOTES), 1u);
+    ASSERT_EQ(totals.count(Repair::BRACKET_CLOSED), 1u);
+}
+
+TEST(TraceTests, TestEventsAreRecorded)
+{
+    SanitizeTrace trace;
+    JsonSanitizer sanitizer{"[1, a, /* b */ 2,]"};
+    sanitizer.setTrace(&trace);
+    sanitizer.sanitize();
+    ASSERT_EQ(asString(sanitizer.toString()), "[1, \"a\",  2]");
+    if constexpr (!TRACING) {
+        ASSERT_EQ(trace.recorded(), 0u);
+        return;
+    }
+    std::vector<std::pair<uint32_t, Repair>> repairs;
+    for (auto const &record : trace.records()) {
+        if (record.event == TraceEvent::REPAIR) {
+            repairs.emplace_back(record.offset, record.repair);
+        }
+    }
+    ASSERT_EQ(repairs, (std::vector<std::pair<uint32_t, Repair>>{{4, Repair::QUOTES_ADDED},
+                                                                {7, Repair::COMMENT},
+                                                                {17, Repair::COMMA_ELIDED}}));
+    auto const last = trace.records().back();
+    ASSERT_EQ(last.event, TraceEvent::COMPLETE);
+    ASSERT_EQ(last.offset, 18u);
+
+    std::ostringstream out;
+    trace.dump(out);
+    ASSERT_NE(out.str().find("offset=7, repair comment, ch=/, state=BEFORE_ELEMENT\n"),
+              std::string::npos);
+}
+
+TEST(TraceTests, TestRingKeepsLatestEvents)
+{
+    SanitizeTrace trace{3};
+    JsonSanitizerStream stream;
+    stream.setTrace(&trace);
+    stream.feed("[1, 2,");
+    stream.feed(" 3, x");
+    stream.finish();
+    if constexpr (!TRACING) {
+        ASSERT_EQ(trace.recorded(), 0u);
+        return;
+    }
+    ASSERT_GT(trace.recorded(), 4u);
+    auto const records = trace.records();
+    ASSERT_EQ(records.size(), 4u);
+    // Offsets are into the whole document, not what the stream still holds.
+    ASSERT_EQ(records[0].event, TraceEvent::TOKEN);
+    ASSERT_EQ(records[0].offset, 10u);
+    ASSERT_EQ(records[1].repair, Repair::QUOTES_ADDED);
+    ASSERT_EQ(records[2].event, TraceEvent::COMPLETE);
+    ASSERT_EQ(records[2].offset, 11u);
+    ASSERT_EQ(records[3].repair, Repair::BRACKET_CLOSED);
+}
+
+TEST(PolicyTests, TestApiPolicyLeavesEmbeddings)
+{
+    std::string_view const json{"[\"<script>\", \"]]>\"]"};
+    ASSERT_EQ(asString(JsonSanitizer::sanitize(json)), "[\"\\u003cscript>\", \"\\u005d]>\"]");
+    auto const result = ApiJsonSanitizer::sanitize(json);
+    ASSERT_EQ(result.index(), 0u);
+    ASSERT_EQ(std::get<0>(result).data(), json.data());
+    ASSERT_EQ(asString(ApiJsonSanitizer::sanitize("[1, 'a</script>b']")),
+              "[1, \"a</script>b\"]");
+}
+
+// Turns off everything that can be turned off.
+struct PlainPolicy : DefaultSanitizerPolicy
+{
+    static inline constexpr bool STRIP_COMMENTS        = false;
+    static inline constexpr bool CANONICALIZE_KEYS     = false;
+    static inline constexpr bool RECODE_NUMBERS        = false;
+    static inline constexpr int  MAXIMUM_NESTING_DEPTH = 8;
+};
+using PlainJsonSanitizer = BasicJsonSanitizer<PlainPolicy>;
+
+TEST(PolicyTests, TestCustomPolicy)
+{
+    ASSERT_EQ(asString(PlainJsonSanitizer::sanitize("{.5: 017, 1e2: [0.5, -012, 0]}")),
+              "{\".5\": \"017\", \"1e2\": [0.5, \"-012\", 0]}");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("{.5: 017, 1e2: [0.5, -012, 0]}")),
+              "{\"0.5\": 15, \"100\": [0.5, -10, 0]}");
+    // Comments are junk like any other.
+    ASSERT_EQ(asString(PlainJsonSanitizer::sanitize("[1 /* c */, 2]")), "[1  ,\"c\" , 2]");
+    ASSERT_EQ(asString(PlainJsonSanitizer::sanitize("['<!--']")), "[\"\\u003c!--\"]");
+
+    static_assert(PlainJsonSanitizer::MAXIMUM_NESTING_DEPTH == 8);
+    static_assert(PlainJsonSanitizer::DEFAULT_NESTING_DEPTH == 8);
+    PlainJsonSanitizer deep{"", std::numeric_limits<int>::max()};
+    ASSERT_EQ(deep.getMaximumNestingDepth(), 8);
+    ASSERT_EQ(asString(PlainJsonSanitizer::sanitize("[[[[[[[[1]]]]]]]]")), "[[[[[[[[1]]]]]]]]");
+    ASSERT_THROW(PlainJsonSanitizer::sanitize("[[[[[[[[[1]]]]]]]]]"), std::out_of_range);
+}
+
+struct ReplacingPolicy : DefaultSanitizerPolicy
+{
+    static inline constexpr Utf8Repair UTF8_REPAIR = Utf8Repair::REPLACE;
+};
+
+struct EscapingPolicy : DefaultSanitizerPolicy
+{
+    static inline constexpr Utf8Repair UTF8_REPAIR = Utf8Repair::ESCAPE;
+};
+
+TEST(Utf8Tests, TestMalformedNeverTakesAscii)
+{
+    // A lead byte used to be taken with the quote and bracket after it.
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("[\"\xe4\"]")), "[\"\xe4\"]");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("[\"\xf0\x9f\"]")), "[\"\xf0\x9f\"]");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("[\xe4]")), "[\"\xe4\"]");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("\x80")), "\"\x80\"");
+    // Nothing non-ASCII can follow a backslash.
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("[\"\\\xc3\xa9\"]")), "[\"\xc3\xa9\"]");
+}
+
+TEST(Utf8Tests, TestReplace)
+{
+    using ReplacingJsonSanitizer = BasicJsonSanitizer<ReplacingPolicy>;
+    // Well-formed text is left alone, lone surrogates are still escaped.
+    std::string_view const valid{"[\"\xc3\xa4\xe6\x97\xa5\xf0\x9d\x84\x9e\"]"};
+    auto const             result = ReplacingJsonSanitizer::sanitize(valid);
+    ASSERT_EQ(result.index(), 0u);
+    ASSERT_EQ(std::get<0>(result).data(), valid.data());
+    ASSERT_EQ(asString(ReplacingJsonSanitizer::sanitize("[\"\xed\xa0\x80\"]")), "[\"\\ud800\"]");
+
+    // One U+FFFD for each maximal malformed sequence.
+    ASSERT_EQ(asString(ReplacingJsonSanitizer::sanitize("[\"a\xe6\x97" "b\"]")),
+              "[\"a\xef\xbf\xbd" "b\"]");
+    ASSERT_EQ(asString(ReplacingJsonSanitizer::sanitize("[\"\x80\xbf\"]")),
+              "[\"\xef\xbf\xbd\xef\xbf\xbd\"]");
+    ASSERT_EQ(asString(ReplacingJsonSanitizer::sanitize("[\"\xc0\xaf\xe0\x80\"]")),
+              "[\"\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\"]");
+    ASSERT_EQ(asString(ReplacingJsonSanitizer::sanitize("[\"\xf4\x90\x80\x80\xf0\x9f\x98\"]")),
+              "[\"\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd\"]");
+    // Unquoted strings are repaired once they are quoted.
+    ASSERT_EQ(asString(ReplacingJsonSanitizer::sanitize("{\xe4: 1}")),
+              "{\"\xef\xbf\xbd\": 1}");
+
+    SanitizeStats stats;
+    auto const    output = ReplacingJsonSanitizer::sanitizeToResult("[\"\xff\"]", stats);
+    ASSERT_EQ(stats.count(Repair::UTF8_REPLACED), 1u);
+    ASSERT_EQ(stats.outputBytes(), output.view().length());
+}
+
+TEST(Utf8Tests, TestEscape)
+{
+    using EscapingJsonSanitizer = BasicJsonSanitizer<EscapingPolicy>;
+    ASSERT_EQ(asString(EscapingJsonSanitizer::sanitize("[\"a\xe6\x97" "b\xff\"]")),
+              "[\"a\\ufffdb\\ufffd\"]");
+    ASSERT_EQ(asString(EscapingJsonSanitizer::sanitize("[\"\xc3\xa4\"]")), "[\"\xc3\xa4\"]");
+}
+
+bool operator==(detail::BlockMasks const &lhs, detail::BlockMasks const &rhs)
+{
+    return (lhs.quote == rhs.quote) && (lhs.apostrophe == rhs.apostrophe) &&
+           (lhs.backslash == rhs.backslash) && (lhs.bracket == rhs.bracket) &&
+           (lhs.brace == rhs.brace) && (lhs.comma == rhs.comma) && (lhs.colon == rhs.colon) &&
+           (lhs.whitespace == rhs.whitespace) && (lhs.slash == rhs.slash) &&
+           (lhs.paren == rhs.paren) && (lhs.angle == rhs.angle) &&
+           (lhs.nonAscii == rhs.nonAscii) && (lhs.control == rhs.control) &&
+           (lhs.lineBreak == rhs.lineBreak) && (lhs.word == rhs.word) && (lhs.utf8 == rhs.utf8);
+}
+
+TEST(DispatchTests, TestWidestIsChosen)
+{
+    auto const classifiers = detail::blockClassifiers();
+    ASSERT_FALSE(classifiers.empty());
+    ASSERT_STREQ(classifiers.front().name, "scalar");
+    ASSERT_STREQ(detail::blockClassifier().name, classifiers.back().name);
+}
+
+TEST(DispatchTests, TestClassifiersAgree)
+{
+    // Every byte value in every position of a block.
+    unsigned char bytes[256 + detail::BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+        bytes[i] = static_cast<unsigned char>(i * 7);
+    }
+    for (auto const &classifier : detail::blockClassifiers()) {
+        for (size_t start = 0; start < 256; ++start) {
+            detail::BlockMasks expected;
+            detail::BlockMasks masks;
+            detail::blockClassifiers().front().classify(bytes + start, expected);
+            classifier.classify(bytes + start, masks);
+            ASSERT_TRUE(masks == expected) << classifier.name << " at " << start;
+        }
+    }
+}
+
+TEST(DispatchTests, TestUtf8)
+{
+    // Characters kept as they are, then one of each kind that is not.
+    std::string block{"\xc3\xa4\xe6\x97\xa5\xf0\x9d\x84\x9e"
+                      "\x80"
+                      "\xc0\xaf"
+                      "\xe0\x9f\xbf"
+                      "\xed\xa0\x80"
+                      "\xe2\x80\xa8"
+                      "\xef\xbf\xbe"
+                      "\xf4\x90\x80\x80"
+                      "\xe6\x97"};
+    auto const plain = block.find('\x80');
+    block.resize(detail::BLOCK_SIZE - 1, ' ');
+    // Cut by the end of the block.
+    block += "\xc3\xa4";
+    uint64_t expected = 0;
+    for (auto i = plain; i < detail::BLOCK_SIZE; ++i) {
+        if (static_cast<unsigned char>(block[i]) >= 0x80) {
+            expected |= uint64_t{1} << i;
+        }
+    }
+    for (auto const &classifier : detail::blockClassifiers()) {
+        detail::BlockMasks masks;
+        classifier.classify(reinterpret_cast<unsigned char const *>(block.data()), masks);
+        ASSERT_EQ(masks.utf8, expected) << classifier.name;
+    }
+
+    // Well-formed characters mixed with the boundary cases, so that every
+    // classifier sees characters of each length at every offset.
+    std::array<std::string_view, 12> const pieces = {
+        "a", "\xc3\xa4", "\xe6\x97\xa5", "\xf0\x9d\x84\x9e", "\xe0\xa0\x80", "\xed\x9f\xbf",
+        "\xf4\x8f\xbf\xbf", "\x80", "\xe0\x9f", "\xed\xa0", "\xe2\x80\xa9", "\xef\xbf\xbf"};
+    std::minstd_rand           random{1};
+    std::vector<unsigned char> bytes;
+    while (bytes.size() < (1u << 16)) {
+        auto const piece = pieces[random() % pieces.size()];
+        bytes.insert(bytes.end(), piece.begin(), piece.end());
+    }
+    for (auto const &classifier : detail::blockClassifiers()) {
+        for (size_t start = 0; start + detail::BLOCK_SIZE <= bytes.size(); start += 61) {
+            detail::BlockMasks expected;
+            detail::BlockMasks masks;
+            detail::blockClassifiers().front().classify(bytes.data() + start, expected);
+            classifier.classify(bytes.data() + start, masks);
+            ASSERT_TRUE(masks == expected) << classifier.name << " at " << start;
+        }
+    }
+}
+
+TEST(AdaptiveTests, TestProfile)
+{
+    std::string const json{"  {\"a\":'\\u00e9', \"\xc3\xa9\":[1,2]}"};
+    auto const        profile = profileInput(json, 16);
+    ASSERT_EQ(profile.length, json.length());
+    ASSERT_EQ(profile.firstByte, '{');
+    ASSERT_EQ(profile.sampled, json.length());
+    ASSERT_EQ(profile.nonAscii, 2u);
+    ASSERT_EQ(profile.quotes, 4u);
+    ASSERT_EQ(profile.apostrophes, 2u);
+    ASSERT_EQ(profile.backslashes, 1u);
+
+    std::string const longer(100 * 64, ' ');
+    ASSERT_EQ(profileInput(longer, 16).sampled, 16u * 64);
+    ASSERT_EQ(profileInput(longer, 16).firstByte, '\0');
+    ASSERT_EQ(profileInput(longer, 0).sampled, 0u);
+}
+
+TEST(AdaptiveTests, TestChooseEngine)
+{
+    DispatchOptions options;
+    options.threads                   = 4;
+    options.pooledMaximumBytes        = 64;
+    options.parallelMinimumBytes      = 4096;
+    options.denseParallelMinimumBytes = 1024;
+
+    InputProfile profile;
+    profile.length = 63;
+    ASSERT_EQ(chooseEngine(profile, options), Engine::POOLED);
+
+    profile.length    = 2048;
+    profile.firstByte = '[';
+    profile.sampled   = 1024;
+    profile.quotes    = 100;
+    ASSERT_EQ(chooseEngine(profile, options), Engine::SERIAL);
+    profile.nonAscii = 128;
+    ASSERT_EQ(chooseEngine(profile, options), Engine::PARALLEL);
+    profile.nonAscii = 0;
+    profile.length   = 4096;
+    ASSERT_EQ(chooseEngine(profile, options), Engine::PARALLEL);
+
+    // Probably needs repair near the start.
+    profile.firstByte = '(';
+    ASSERT_EQ(chooseEngine(profile, options), Engine::SERIAL);
+    profile.firstByte   = '{';
+    profile.apostrophes = 1;
+    ASSERT_EQ(chooseEngine(profile, options), Engine::SERIAL);
+    profile.apostrophes = 0;
+    // Mostly short strings.
+    profile.quotes = 400;
+    ASSERT_EQ(chooseEngine(profile, options), Engine::SERIAL);
+    profile.quotes  = 100;
+    options.threads = 1;
+    ASSERT_EQ(chooseEngine(profile, options), Engine::SERIAL);
+}
+
+TEST(AdaptiveTests, TestEnginesAgree)
+{
+    DispatchOptions options;
+    options.threads              = 3;
+    options.grainSize            = 16;
+    options.pooledMaximumBytes   = 32;
+    options.parallelMinimumBytes = 64;
+
+    std::string valid{"["};
+    for (int i = 0; i < 20; ++i) {
+        valid += "{\"key\": [1, 2.5, true, null], \"other\": \"a long enough string\"},";
+    }
+    valid += "{}]";
+    std::string const malformed{"{a: 'b', c: [1, 2,], /* d */ e: 0x10}"};
+    std::string const small{"[1, 2,]"};
+
+    auto const before = RepairStatistics::totals();
+    RepairStatistics::setEnabled(true);
+    SanitizeStats stats;
+    for (auto const &json : {valid, malformed, small}) {
+        ASSERT_EQ(sanitizeAdaptive(json, stats, options).view(),
+                  JsonSanitizer::sanitizeToResult(json).view());
+    }
+    RepairStatistics::setEnabled(false);
+    ASSERT_EQ(stats.documents, 3u);
+    ASSERT_EQ(stats.count(Engine::PARALLEL), 1u);
+    ASSERT_EQ(stats.count(Engine::SERIAL), 1u);
+    ASSERT_EQ(stats.count(Engine::POOLED), 1u);
+    ASSERT_EQ(stats.count(Repair::COMMA_ELIDED), 2u);
+    ASSERT_STREQ(SanitizeStats::name(Engine::POOLED), "pooled");
+
+    auto totals = RepairStatistics::totals();
+    totals -= before;
+    ASSERT_EQ(totals.count(Engine::PARALLEL), 1u);
+    ASSERT_EQ(totals.count(Engine::SERIAL), 1u);
+    ASSERT_EQ(totals.count(Engine::POOLED), 1u);
+
+    options.maximumNestingDepth = 2;
+    ASSERT_THROW(sanitizeAdaptive("[[[1]]]", options), std::out_of_range);
+}
+
 // These triggered index out of bounds and assertion errors.
 TEST(TestIssue3, TestIndexOutOfBounds)
 {
@@ -701,6 +1589,22 @@ TEST(TestHtmlParserStateChanges, TestXMLComment4)
 {
     ASSERT_EQ(asString(JsonSanitizer::sanitize("-->")), "-0");
 }
+TEST(TestHtmlParserStateChanges, TestXMLComment5)
+{
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("\"foo-->\"")), "\"foo--\\u003e\"");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("{<script-->tru")),
+              "{\"script--\\u003etru\":null}");
+}
+TEST(TestHtmlParserStateChanges, TestLongString)
+{
+    // Characters needing attention either side of the 64 byte block boundaries.
+    auto const a = std::string(62, 'a');
+    auto const b = std::string(61, 'b');
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("\"" + a + "<!--" + b + "\n\"")),
+              "\"" + a + "\\u003c!--" + b + "\\n\"");
+    ASSERT_EQ(asString(JsonSanitizer::sanitize("'" + a + "-->" + b + "]]>'")),
+              "\"" + a + "--\\u003e" + b + "\\u005d]>\"");
+}
 TEST(TestHtmlParserStateChanges, TestScriptXMLComment)
 {
     ASSERT_EQ(asString(JsonSanitizer::sanitize("\"<!--<script>\"")),
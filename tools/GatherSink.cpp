@@ -0,0 +1,179 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "GatherSink.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace jsonsanitise {
+
+namespace {
+
+/// Calls transfer until all of pieces has gone, skipping past what each call
+/// managed to write.
+template <typename Transfer>
+size_t transferAll(iovec *pieces, size_t count, Transfer transfer, char const *what)
+{
+    size_t total = 0;
+    while (count != 0) {
+        auto n = transfer(pieces, std::min(count, GatherSink::MAX_PIECES));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error{errno, std::generic_category(), what};
+        }
+        total += static_cast<size_t>(n);
+        while ((count != 0) && (static_cast<size_t>(n) >= pieces->iov_len)) {
+            n -= static_cast<ssize_t>(pieces->iov_len);
+            ++pieces;
+            --count;
+        }
+        if (n > 0) {
+            pieces->iov_base = static_cast<char *>(pieces->iov_base) + n;
+            pieces->iov_len -= static_cast<size_t>(n);
+        }
+    }
+    return total;
+}
+
+} // namespace
+
+GatherSink::GatherSink(int fd, std::string_view input)
+    : _fd{fd}
+    , _input{input}
+    , _splice{false}
+    , _copies{new char[COPY_CAPACITY]}
+{
+#if defined(__linux__)
+    struct stat st;
+    _splice = (::fstat(fd, &st) == 0) && S_ISFIFO(st.st_mode);
+#endif
+    _pieces.reserve(MAX_PIECES);
+}
+
+GatherSink::~GatherSink()
+{
+    try {
+        flush();
+    } catch (std::system_error const &) {
+    }
+}
+
+void GatherSink::write(std::string_view s)
+{
+    if (s.empty()) {
+        return;
+    }
+    if (_pieces.size() == MAX_PIECES) {
+        flush();
+    }
+    if ((s.data() >= _input.data()) && (s.data() + s.length() <= _input.data() + _input.length())) {
+        add(s.data(), s.length());
+        return;
+    }
+    if (s.length() > COPY_CAPACITY - _copied) {
+        flush();
+    }
+    if (s.length() > COPY_CAPACITY) {
+        // s is only valid during this call, so it has to go out now.
+        add(s.data(), s.length());
+        flush();
+        return;
+    }
+    std::memcpy(_copies.get() + _copied, s.data(), s.length());
+    add(_copies.get() + _copied, s.length());
+    _copied += s.length();
+}
+
+void GatherSink::flush()
+{
+    auto *const pieces = _pieces.data();
+    auto const  count  = _pieces.size();
+    for (size_t i = 0; i < count;) {
+        // Runs of input and of copies alternate. Copies always go with writev
+        // since their buffer is reused.
+        auto const input = _splice && isInput(pieces[i]);
+        auto       end   = i + 1;
+        while ((end < count) && (_splice && isInput(pieces[end])) == input) {
+            ++end;
+        }
+        if (input) {
+            spliceAll(pieces + i, end - i);
+        } else {
+            writeAll(pieces + i, end - i);
+        }
+        i = end;
+    }
+    _pieces.clear();
+    _copied = 0;
+}
+
+bool GatherSink::isInput(iovec const &piece) const noexcept
+{
+    auto const data = static_cast<char const *>(piece.iov_base);
+    return (data >= _input.data()) && (data < _input.data() + _input.length());
+}
+
+void GatherSink::add(char const *data, size_t length)
+{
+    iovec const piece = {const_cast<char *>(data), length};
+    if (!_pieces.empty()) {
+        auto &last = _pieces.back();
+        if ((static_cast<char const *>(last.iov_base) + last.iov_len == data) &&
+            (isInput(last) == isInput(piece))) {
+            last.iov_len += length;
+            return;
+        }
+    }
+    _pieces.push_back(piece);
+}
+
+void GatherSink::writeAll(iovec *pieces, size_t count)
+{
+    _written += transferAll(
+        pieces, count,
+        [this](iovec const *p, size_t n) { return ::writev(_fd, p, static_cast<int>(n)); },
+        "writev");
+}
+
+void GatherSink::spliceAll(iovec *pieces, size_t count)
+{
+#if defined(__linux__)
+    _written += transferAll(
+        pieces, count,
+        [this](iovec const *p, size_t n) {
+            if (_splice) {
+                auto const spliced = ::vmsplice(_fd, p, n, 0);
+                // Some pipes, such as those of some sandboxes, refuse vmsplice.
+                if ((spliced >= 0) || ((errno != EINVAL) && (errno != ENOSYS))) {
+                    return spliced;
+                }
+                _splice = false;
+            }
+            return ::writev(_fd, p, static_cast<int>(n));
+        },
+        "vmsplice");
+#else
+    writeAll(pieces, count);
+#endif
+}
+
+} // namespace jsonsanitise
@@ -0,0 +1,76 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Output for the jsonsanitise tool. Pieces of output that are spans of the
+// mapped input are handed to the kernel where they lie instead of being
+// copied into a buffer first.
+
+#pragma once
+
+#include "OutputSink.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <sys/uio.h>
+
+namespace jsonsanitise {
+
+/// Writes to a file descriptor with writev. A piece that lies inside input is
+/// written from where it is; anything else is copied into a buffer, and
+/// adjacent pieces are merged. On Linux, when fd is a pipe, spans of input
+/// are moved into it with vmsplice so that not even the kernel copies them.
+/// input has to stay mapped and unchanged until flush() returns. Throws
+/// std::system_error if a write fails.
+class GatherSink final : public com::google::json::OutputSink
+{
+    int                     _fd;
+    std::string_view        _input;
+    bool                    _splice;
+    std::vector<iovec>      _pieces;
+    std::unique_ptr<char[]> _copies;
+    size_t                  _copied  = 0;
+    size_t                  _written = 0;
+
+public:
+    static inline constexpr size_t COPY_CAPACITY = 64 * 1024;
+    static inline constexpr size_t MAX_PIECES    = 1024;
+
+    GatherSink(int fd, std::string_view input);
+
+    GatherSink(GatherSink const &) = delete;
+    GatherSink &operator=(GatherSink const &) = delete;
+
+    /// Writes anything still waiting, ignoring errors.
+    ~GatherSink() override;
+
+    void write(std::string_view s) override;
+    void flush() override;
+
+    /// The number of bytes written to fd so far.
+    size_t written() const noexcept
+    {
+        return _written;
+    }
+
+private:
+    bool isInput(iovec const &piece) const noexcept;
+    void add(char const *data, size_t length);
+    void writeAll(iovec *pieces, size_t count);
+    void spliceAll(iovec *pieces, size_t count);
+};
+
+} // namespace jsonsanitise
@@ -0,0 +1,95 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include "MappedFile.hpp"
+
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace jsonsanitise {
+
+MappedFile::MappedFile(std::string const &path)
+{
+    if (path == "-") {
+        load(STDIN_FILENO);
+        return;
+    }
+    auto const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error{errno, std::generic_category(), "open"};
+    }
+    try {
+        load(fd);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    // The mapping does not need the descriptor to stay open.
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (_data != nullptr) {
+        ::munmap(_data, _size);
+    }
+}
+
+void MappedFile::load(int fd)
+{
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        throw std::system_error{errno, std::generic_category(), "stat"};
+    }
+    if (S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            return;
+        }
+        auto const size = static_cast<size_t>(st.st_size);
+        auto const data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            // The sanitizer reads the input once, front to back, so the pages
+            // can be read well ahead and dropped soon after.
+            ::madvise(data, size, MADV_SEQUENTIAL);
+            _data = data;
+            _size = size;
+            return;
+        }
+    }
+    readAll(fd);
+}
+
+void MappedFile::readAll(int fd)
+{
+    char buffer[64 * 1024];
+    for (;;) {
+        auto const n = ::read(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error{errno, std::generic_category(), "read"};
+        }
+        if (n == 0) {
+            break;
+        }
+        _contents.append(buffer, static_cast<size_t>(n));
+    }
+}
+
+} // namespace jsonsanitise
@@ -0,0 +1,58 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Input for the jsonsanitise tool. Files are mapped rather than read so that
+// the sanitizer can work on them in place and spans it leaves alone can be
+// written out from the mapping.
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace jsonsanitise {
+
+/// A file mapped read-only for a single pass from front to back. Anything
+/// that cannot be mapped, such as a pipe on standard input, is read into
+/// memory instead. Throws std::system_error if the file cannot be opened.
+class MappedFile final
+{
+    void       *_data = nullptr;
+    size_t      _size = 0;
+    std::string _contents;
+
+public:
+    /// Maps path, or standard input if path is "-".
+    explicit MappedFile(std::string const &path);
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    ~MappedFile();
+
+    std::string_view view() const noexcept
+    {
+        if (_data != nullptr) {
+            return {static_cast<char const *>(_data), _size};
+        }
+        return _contents;
+    }
+
+private:
+    void load(int fd);
+    void readAll(int fd);
+};
+
+} // namespace jsonsanitise
@@ -0,0 +1,334 @@
+﻿// Copyright (C) 2020 D. Bailey
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// jsonsanitise: sanitizes JSON files, whole directories of them or standard
+// input. Inputs are mapped rather than read and the parts of them that need
+// no changes are written straight from the mapping.
+
+#include "GatherSink.hpp"
+#include "MappedFile.hpp"
+#include "SanitizeBatch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+using namespace com::google::json;
+
+namespace jsonsanitise {
+
+namespace {
+
+char const USAGE[] =
+    "usage: jsonsanitise [-o OUTPUT] [-j THREADS] [-d DEPTH] [-f lines|rs|length] [-q] [INPUT...]\n"
+    "\n"
+    "Sanitizes each INPUT, a file, a directory or - for standard input, which is also\n"
+    "what is read if there are none.\n"
+    "\n"
+    "  -o OUTPUT   where to write. For a single file this is a file, standard output if\n"
+    "              it is missing. For several inputs or a directory it is a directory\n"
+    "              the outputs are written under, with the same relative paths.\n"
+    "  -j THREADS  the number of threads, by default one for each hardware thread.\n"
+    "              Several files are spread across them; a single file is scanned\n"
+    "              in parallel.\n"
+    "  -d DEPTH    the maximum nesting depth, by default 64.\n"
+    "  -f FRAMING  sanitize each record of newline delimited JSON (lines), RFC 7464\n"
+    "              text sequences (rs) or length prefixed records (length) on its own.\n"
+    "  -q          do not report throughput on standard error.\n";
+
+struct Options
+{
+    std::string                  output;
+    unsigned                     threads = 0;
+    int                          depth   = JsonSanitizer::DEFAULT_NESTING_DEPTH;
+    std::optional<RecordFraming> framing;
+    bool                         quiet = false;
+    std::vector<std::string>     inputs;
+};
+
+/// One input and where its output goes. An empty output is standard output.
+struct Job
+{
+    std::string input;
+    std::string output;
+    uintmax_t   size = 0;
+};
+
+struct Totals
+{
+    std::atomic<size_t>   files{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<bool>     failed{false};
+};
+
+std::mutex errorMutex;
+
+void reportError(std::string const &input, char const *message)
+{
+    std::lock_guard<std::mutex> lock{errorMutex};
+    std::fprintf(stderr, "jsonsanitise: %s: %s\n", input.c_str(), message);
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if ((arg.length() < 2) || (arg[0] != '-')) {
+            options.inputs.emplace_back(arg);
+            continue;
+        }
+        auto const flag = arg[1];
+        if ((flag == 'q') && (arg.length() == 2)) {
+            options.quiet = true;
+            continue;
+        }
+        if ((flag == 'h') && (arg.length() == 2)) {
+            std::fputs(USAGE, stdout);
+            std::exit(EXIT_SUCCESS);
+        }
+        // The value is either the rest of this argument or the next one.
+        std::string_view value = arg.substr(2);
+        if (value.empty()) {
+            if (++i == argc) {
+                return false;
+            }
+            value = argv[i];
+        }
+        switch (flag) {
+            case 'o':
+                options.output = value;
+                break;
+            case 'j':
+                options.threads = static_cast<unsigned>(std::strtoul(value.data(), nullptr, 10));
+                break;
+            case 'd':
+                options.depth = std::atoi(value.data());
+                break;
+            case 'f':
+                if (value == "lines") {
+                    options.framing = RecordFraming::LINES;
+                } else if (value == "rs") {
+                    options.framing = RecordFraming::RECORD_SEPARATOR;
+                } else if (value == "length") {
+                    options.framing = RecordFraming::LENGTH_PREFIXED;
+                } else {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    if (options.inputs.empty()) {
+        options.inputs.emplace_back("-");
+    }
+    if (options.threads == 0) {
+        options.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return true;
+}
+
+/// Lists the regular files under directory, with their outputs under output.
+void addDirectory(fs::path const &directory, fs::path const &output, std::vector<Job> &jobs)
+{
+    std::error_code ignored;
+    for (auto it = fs::recursive_directory_iterator{directory}; it != fs::end(it); ++it) {
+        // Leave out earlier output if it is written inside the input.
+        if (it->is_directory() && fs::equivalent(it->path(), output, ignored)) {
+            it.disable_recursion_pending();
+            continue;
+        }
+        if (it->is_regular_file()) {
+            auto const target = output / fs::relative(it->path(), directory);
+            jobs.push_back({it->path().string(), target.string(), it->file_size()});
+        }
+    }
+}
+
+std::vector<Job> listJobs(Options const &options)
+{
+    std::vector<Job> jobs;
+    auto const      &inputs = options.inputs;
+    if ((inputs.size() == 1) && !fs::is_directory(inputs[0])) {
+        std::error_code ignored;
+        auto const      size = fs::file_size(inputs[0], ignored);
+        jobs.push_back({inputs[0], options.output, (size == uintmax_t(-1)) ? 0 : size});
+        return jobs;
+    }
+    if (options.output.empty()) {
+        throw std::runtime_error{"-o is needed for several inputs or a directory"};
+    }
+    fs::path const output = options.output;
+    if (inputs.size() == 1) {
+        addDirectory(inputs[0], output, jobs);
+    } else {
+        for (auto const &input : inputs) {
+            if (input == "-") {
+                throw std::runtime_error{"- cannot be one of several inputs"};
+            }
+            // Each of several inputs goes under its own name, as with cp -r.
+            fs::path path = input;
+            auto     name = path.filename();
+            if (name.empty()) {
+                name = path.parent_path().filename();
+            }
+            if (fs::is_directory(path)) {
+                addDirectory(path, output / name, jobs);
+            } else {
+                jobs.push_back({input, (output / name).string(), fs::file_size(path)});
+            }
+        }
+    }
+    // Start on the biggest files so that the last ones to finish are small.
+    std::stable_sort(jobs.begin(), jobs.end(),
+                     [](Job const &a, Job const &b) { return a.size > b.size; });
+    return jobs;
+}
+
+int openOutput(std::string const &input, std::string const &output)
+{
+    if (output.empty()) {
+        return STDOUT_FILENO;
+    }
+    // Truncating the input while it is mapped would fault the reads.
+    std::error_code ignored;
+    if (fs::equivalent(input, output, ignored)) {
+        throw std::runtime_error{"the output is the input"};
+    }
+    auto const parent = fs::path{output}.parent_path();
+    if (!parent.empty()) {
+        fs::create_directories(parent);
+    }
+    auto const fd = ::open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        throw std::system_error{errno, std::generic_category(), output};
+    }
+    return fd;
+}
+
+void sanitizeFile(Job const &job, Options const &options, unsigned threads, Totals &totals)
+{
+    MappedFile   input{job.input};
+    auto const   fd = openOutput(job.input, job.output);
+    BatchOptions batch;
+    batch.maximumNestingDepth = options.depth;
+    batch.threads             = threads;
+    try {
+        GatherSink sink{fd, input.view()};
+        if (options.framing) {
+            sanitizeRecords(input.view(), *options.framing, sink, batch);
+        } else {
+            sanitizeParallel(input.view(), sink, batch);
+        }
+        sink.flush();
+        totals.bytesOut += sink.written();
+    } catch (...) {
+        if (fd != STDOUT_FILENO) {
+            ::close(fd);
+        }
+        throw;
+    }
+    if ((fd != STDOUT_FILENO) && (::close(fd) != 0)) {
+        throw std::system_error{errno, std::generic_category(), job.output};
+    }
+    totals.bytesIn += input.view().length();
+    ++totals.files;
+}
+
+void run(std::vector<Job> const &jobs, Options const &options, Totals &totals)
+{
+    // One file gets every thread. Otherwise each file is sanitized on one
+    // thread and the files are handed out to as many threads as there are.
+    auto const perFile = (jobs.size() == 1) ? options.threads : 1u;
+    auto const workers = std::min<size_t>(jobs.size(), options.threads);
+
+    std::atomic<size_t> next{0};
+    auto const          work = [&]() {
+        for (auto i = next++; i < jobs.size(); i = next++) {
+            try {
+                sanitizeFile(jobs[i], options, perFile, totals);
+            } catch (std::exception const &e) {
+                reportError(jobs[i].input, e.what());
+                totals.failed = true;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers; ++i) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+} // namespace
+
+} // namespace jsonsanitise
+
+int main(int argc, char **argv)
+{
+    using namespace jsonsanitise;
+
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        std::fputs(USAGE, stderr);
+        return 2;
+    }
+    std::vector<Job> jobs;
+    try {
+        jobs = listJobs(options);
+    } catch (std::exception const &e) {
+        std::fprintf(stderr, "jsonsanitise: %s\n", e.what());
+        return 2;
+    }
+
+    Totals     totals;
+    auto const start = std::chrono::steady_clock::now();
+    run(jobs, options, totals);
+    auto const seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!options.quiet) {
+        auto const megabytesIn = static_cast<double>(totals.bytesIn) / 1e6;
+        std::fprintf(stderr,
+                     "jsonsanitise: %zu files, %.1f MB in, %.1f MB out, %.3f s, %.1f MB/s\n",
+                     totals.files.load(), megabytesIn,
+                     static_cast<double>(totals.bytesOut) / 1e6, seconds,
+                     (seconds > 0) ? megabytesIn / seconds : 0.0);
+    }
+    return totals.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}